@@ -0,0 +1,399 @@
+#ifndef CIRCUIT_H
+#define CIRCUIT_H
+
+#include <cctype>
+#include <cmath>
+#include <complex>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Backend-neutral circuit: a list of one- and two-qubit gates, each with its
+// dense unitary already built, so the backends only translate matrices and
+// nothing is generated inside the timed region. Matrices are row-major over
+// the gate's qubits in ascending order, with qubits[0] as the lowest index bit
+// (QuEST's convention); qubit q is ITensor site q + 1.
+struct CircuitOp {
+  std::string name;
+  std::vector<int> qubits;
+  std::vector<std::complex<double>> matrix;
+};
+
+struct Circuit {
+  int qubits;
+  std::vector<CircuitOp> ops;
+};
+
+
+// ========================================================================= //
+// ------------------------------- Matrices -------------------------------- //
+// ========================================================================= //
+
+typedef std::vector<std::complex<double>> CircuitMatrix;
+
+inline CircuitMatrix u3_matrix(double theta, double phi, double lambda) {
+  double c = cos(theta / 2), s = sin(theta / 2);
+  return {c, -std::polar(s, lambda), std::polar(s, phi), std::polar(c, phi + lambda)};
+}
+
+// Single-qubit gates of qelib1.inc, plus the sqrt(Y) and sqrt(W) gates of
+// the random circuit, W = (X - Y) / sqrt(2) (the matrix of ITensor's makeSW)
+inline CircuitMatrix single_matrix(std::string const& name, std::vector<double> const& p) {
+  std::complex<double> i(0, 1);
+  double h = 1 / sqrt(2.0);
+  if (name == "id") return {1, 0, 0, 1};
+  if (name == "x") return {0, 1, 1, 0};
+  if (name == "y") return {0, -i, i, 0};
+  if (name == "z") return {1, 0, 0, -1};
+  if (name == "h") return {h, h, h, -h};
+  if (name == "s") return {1, 0, 0, i};
+  if (name == "sdg") return {1, 0, 0, -i};
+  if (name == "t") return {1, 0, 0, std::polar(1.0, M_PI / 4)};
+  if (name == "tdg") return {1, 0, 0, std::polar(1.0, -M_PI / 4)};
+  if (name == "sx") return {(1. + i) / 2., (1. - i) / 2., (1. - i) / 2., (1. + i) / 2.};
+  if (name == "sxdg") return {(1. - i) / 2., (1. + i) / 2., (1. + i) / 2., (1. - i) / 2.};
+  if (name == "sy") return {(1. + i) / 2., -(1. + i) / 2., (1. + i) / 2., (1. + i) / 2.};
+  if (name == "sw") return {(1. + i) / 2., h, -i * h, (1. + i) / 2.};
+  if (name == "rx") return u3_matrix(p[0], -M_PI / 2, M_PI / 2);
+  if (name == "ry") return u3_matrix(p[0], 0, 0);
+  if (name == "rz") return {std::polar(1.0, -p[0] / 2), 0, 0, std::polar(1.0, p[0] / 2)};
+  if (name == "p" || name == "u1") return {1, 0, 0, std::polar(1.0, p[0])};
+  if (name == "u2") return u3_matrix(M_PI / 2, p[0], p[1]);
+  if (name == "u3" || name == "u" || name == "U") return u3_matrix(p[0], p[1], p[2]);
+  return {};
+}
+
+inline int gate_params(std::string const& name) {
+  static const std::map<std::string, int> params = {
+    {"rx", 1}, {"ry", 1}, {"rz", 1}, {"p", 1}, {"u1", 1}, {"u2", 2}, {"u3", 3}, {"u", 3},
+    {"U", 3}, {"crx", 1}, {"cry", 1}, {"crz", 1}, {"cp", 1}, {"cu1", 1}, {"cu3", 3},
+    {"rzz", 1}};
+  auto it = params.find(name);
+  return it == params.end() ? 0 : it->second;
+}
+
+// Two-qubit matrix with the first argument as the low index bit
+inline CircuitMatrix pair_matrix(std::string const& name, std::vector<double> const& p) {
+  if (name == "swap")
+    return {1, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 0, 0, 0, 1};
+  if (name == "rzz") {
+    std::complex<double> a = std::polar(1.0, -p[0] / 2), b = std::polar(1.0, p[0] / 2);
+    return {a, 0, 0, 0, 0, b, 0, 0, 0, 0, b, 0, 0, 0, 0, a};
+  }
+
+  // Controlled gates: the control is the first argument
+  std::string base = name == "CX" ? "x" : name.substr(1);
+  if (name[0] != 'c' && name != "CX")
+    return {};
+  CircuitMatrix u = single_matrix(base, p);
+  if (u.empty())
+    return {};
+
+  CircuitMatrix m(16, 0);
+  m[0] = m[10] = 1;
+  for (int r = 0; r < 2; r++)
+    for (int c = 0; c < 2; c++)
+      m[(2 * r + 1) * 4 + 2 * c + 1] = u[2 * r + c];
+  return m;
+}
+
+// Builds the op for name on qubits, in ascending qubit order
+inline CircuitOp make_op(std::string const& name, std::vector<int> const& qubits,
+                         std::vector<double> const& params) {
+  if ((int) params.size() != gate_params(name))
+    throw std::invalid_argument("Gate '" + name + "' takes " + std::to_string(gate_params(name)) +
+                                " parameters");
+
+  CircuitOp op = {name, qubits, {}};
+  if (qubits.size() == 1) {
+    op.matrix = single_matrix(name, params);
+  } else if (qubits.size() == 2) {
+    if (qubits[0] == qubits[1])
+      throw std::invalid_argument("Gate '" + name + "' is applied twice to the same qubit");
+    op.matrix = pair_matrix(name, params);
+    if (!op.matrix.empty() && qubits[0] > qubits[1]) {
+      // Swap the roles of the two index bits
+      CircuitMatrix m(16);
+      auto flip = [](int k) { return (k & 1) << 1 | (k >> 1 & 1); };
+      for (int r = 0; r < 4; r++)
+        for (int c = 0; c < 4; c++)
+          m[flip(r) * 4 + flip(c)] = op.matrix[r * 4 + c];
+      op.matrix = m;
+      op.qubits = {qubits[1], qubits[0]};
+    }
+  }
+
+  if (op.matrix.empty())
+    throw std::invalid_argument("Unsupported gate '" + name + "' on " +
+                                std::to_string(qubits.size()) + " qubits");
+  return op;
+}
+
+
+// ========================================================================= //
+// ------------------------------- Builtins -------------------------------- //
+// ========================================================================= //
+
+// Hadamard on each qubit followed by its controlled phases from all higher
+// qubits, then the final qubit reversal, as in the QuEST qft program
+inline Circuit qft_circuit(int n) {
+  Circuit circuit = {n, {}};
+  for (int i = 0; i < n; i++) {
+    circuit.ops.push_back(make_op("h", {i}, {}));
+    for (int j = i + 1; j < n; j++)
+      circuit.ops.push_back(make_op("cp", {j, i}, {2 * M_PI / pow(2.0, j - i + 1)}));
+  }
+  for (int i = 0; i < n / 2; i++)
+    circuit.ops.push_back(make_op("swap", {i, n - i - 1}, {}));
+  return circuit;
+}
+
+// Layers of random sqrt(X), sqrt(Y) or sqrt(W) on every qubit, followed by
+// controlled pi/2 phases on alternating nearest-neighbour pairs, drawn from a
+// seeded generator so every backend and platform gets the same circuit
+inline Circuit random_circuit(int n, int depth, unsigned long seed) {
+  static const char* names[3] = {"sx", "sy", "sw"};
+  std::mt19937_64 rng(seed);
+  Circuit circuit = {n, {}};
+  for (int i = 0; i < depth; i++) {
+    for (int j = 0; j < n; j++)
+      circuit.ops.push_back(make_op(names[rng() % 3], {j}, {}));
+    for (int j = i % 2; j < n - 1; j += 2)
+      circuit.ops.push_back(make_op("cp", {j, j + 1}, {M_PI / 2}));
+  }
+  return circuit;
+}
+
+
+// ========================================================================= //
+// ------------------------------ OpenQASM 2 ------------------------------- //
+// ========================================================================= //
+
+// Recursive-descent evaluator for gate parameters: numbers, pi, + - * / ^,
+// unary minus, parentheses and sin, cos, tan, exp, ln, sqrt
+struct QasmExpr {
+  std::string s;
+  size_t pos;
+
+  void skip() {
+    while (pos < s.size() && isspace(s[pos]))
+      pos++;
+  }
+
+  double primary() {
+    skip();
+    if (pos < s.size() && s[pos] == '(') {
+      pos++;
+      double v = sum();
+      skip();
+      if (pos >= s.size() || s[pos] != ')')
+        throw std::invalid_argument("Missing ')' in '" + s + "'");
+      pos++;
+      return v;
+    }
+    if (pos < s.size() && s[pos] == '-') {
+      pos++;
+      return -power();
+    }
+    if (pos < s.size() && isalpha(s[pos])) {
+      size_t start = pos;
+      while (pos < s.size() && isalnum(s[pos]))
+        pos++;
+      std::string word = s.substr(start, pos - start);
+      if (word == "pi")
+        return M_PI;
+      double v = primary();
+      if (word == "sin") return sin(v);
+      if (word == "cos") return cos(v);
+      if (word == "tan") return tan(v);
+      if (word == "exp") return exp(v);
+      if (word == "ln") return log(v);
+      if (word == "sqrt") return sqrt(v);
+      throw std::invalid_argument("Unknown function '" + word + "' in '" + s + "'");
+    }
+    char* end;
+    double v = strtod(s.c_str() + pos, &end);
+    if (end == s.c_str() + pos)
+      throw std::invalid_argument("Cannot parse parameter '" + s + "'");
+    pos = end - s.c_str();
+    return v;
+  }
+
+  double power() {
+    double v = primary();
+    skip();
+    if (pos < s.size() && s[pos] == '^') {
+      pos++;
+      return pow(v, power());
+    }
+    return v;
+  }
+
+  double product() {
+    double v = power();
+    for (skip(); pos < s.size() && (s[pos] == '*' || s[pos] == '/'); skip()) {
+      char op = s[pos++];
+      double w = power();
+      v = op == '*' ? v * w : v / w;
+    }
+    return v;
+  }
+
+  double sum() {
+    double v = product();
+    for (skip(); pos < s.size() && (s[pos] == '+' || s[pos] == '-'); skip()) {
+      char op = s[pos++];
+      double w = product();
+      v = op == '+' ? v + w : v - w;
+    }
+    return v;
+  }
+};
+
+inline double qasm_param(std::string const& text) {
+  QasmExpr expr = {text, 0};
+  double v = expr.sum();
+  expr.skip();
+  if (expr.pos != text.size())
+    throw std::invalid_argument("Cannot parse parameter '" + text + "'");
+  return v;
+}
+
+inline std::string qasm_trim(std::string const& s) {
+  size_t a = s.find_first_not_of(" \t\r\n");
+  size_t b = s.find_last_not_of(" \t\r\n");
+  return a == std::string::npos ? "" : s.substr(a, b - a + 1);
+}
+
+// Splits on commas outside parentheses
+inline std::vector<std::string> qasm_split(std::string const& s) {
+  std::vector<std::string> parts;
+  int depth = 0;
+  std::string part;
+  for (char c : s) {
+    depth += (c == '(') - (c == ')');
+    if (c == ',' && depth == 0) {
+      parts.push_back(qasm_trim(part));
+      part.clear();
+    } else {
+      part += c;
+    }
+  }
+  if (!qasm_trim(part).empty())
+    parts.push_back(qasm_trim(part));
+  return parts;
+}
+
+// Loads the OpenQASM 2 subset of qreg declarations and one- and two-qubit
+// qelib1 gates. Several qregs are laid out one after the other; creg,
+// barrier and measure are ignored. Custom gate definitions, classical
+// control and reset are rejected.
+inline Circuit load_qasm(std::string const& path) {
+  std::ifstream file(path);
+  if (!file)
+    throw std::invalid_argument("Cannot open circuit file '" + path + "'");
+
+  std::string text, line;
+  while (getline(file, line))
+    text += line.substr(0, line.find("//")) + "\n";
+
+  Circuit circuit = {0, {}};
+  std::map<std::string, std::pair<int, int>> qregs; // name -> (offset, size)
+
+  auto qubit_args = [&](std::string const& arg) {
+    std::vector<int> qubits;
+    size_t open = arg.find('[');
+    std::string reg = qasm_trim(arg.substr(0, open));
+    auto it = qregs.find(reg);
+    if (it == qregs.end())
+      throw std::invalid_argument("Unknown register '" + reg + "'");
+    if (open == std::string::npos) {
+      for (int q = 0; q < it->second.second; q++)
+        qubits.push_back(it->second.first + q);
+    } else {
+      int q = atoi(arg.c_str() + open + 1);
+      if (q < 0 || q >= it->second.second)
+        throw std::invalid_argument("Qubit '" + arg + "' is out of range");
+      qubits.push_back(it->second.first + q);
+    }
+    return qubits;
+  };
+
+  std::stringstream statements(text);
+  std::string statement;
+  while (getline(statements, statement, ';')) {
+    statement = qasm_trim(statement);
+    if (statement.empty())
+      continue;
+
+    size_t end = statement.find_first_of(" \t\n(");
+    std::string word = statement.substr(0, end);
+    std::string rest = end == std::string::npos ? "" : statement.substr(end);
+
+    if (word == "OPENQASM" || word == "include" || word == "creg" || word == "barrier" ||
+        word == "measure")
+      continue;
+    if (word == "gate" || word == "opaque" || word == "if" || word == "reset")
+      throw std::invalid_argument("Unsupported OpenQASM statement '" + word + "'");
+
+    if (word == "qreg") {
+      size_t open = rest.find('[');
+      std::string reg = qasm_trim(rest.substr(0, open));
+      int size = open == std::string::npos ? 0 : atoi(rest.c_str() + open + 1);
+      if (size <= 0)
+        throw std::invalid_argument("Bad register declaration '" + statement + "'");
+      qregs[reg] = {circuit.qubits, size};
+      circuit.qubits += size;
+      continue;
+    }
+
+    std::vector<double> params;
+    rest = qasm_trim(rest);
+    if (!rest.empty() && rest[0] == '(') {
+      size_t close = rest.rfind(')');
+      if (close == std::string::npos)
+        throw std::invalid_argument("Missing ')' in '" + statement + "'");
+      for (auto const& p : qasm_split(rest.substr(1, close - 1)))
+        params.push_back(qasm_param(p));
+      rest = rest.substr(close + 1);
+    }
+
+    std::vector<std::vector<int>> args;
+    for (auto const& a : qasm_split(rest))
+      args.push_back(qubit_args(a));
+
+    // A whole register as the argument of a single-qubit gate applies it to
+    // every qubit of the register
+    if (args.size() == 1) {
+      for (int q : args[0])
+        circuit.ops.push_back(make_op(word, {q}, params));
+    } else if (args.size() == 2 && args[0].size() == 1 && args[1].size() == 1) {
+      circuit.ops.push_back(make_op(word, {args[0][0], args[1][0]}, params));
+    } else {
+      throw std::invalid_argument("Unsupported arguments in '" + statement + "'");
+    }
+  }
+
+  if (circuit.qubits == 0)
+    throw std::invalid_argument("Circuit file '" + path + "' declares no qubits");
+  return circuit;
+}
+
+// Builtin circuit by name ("qft", "rand") or an OpenQASM 2 file
+inline Circuit load_circuit(std::string const& name, int qubits, int depth) {
+  if (name == "qft")
+    return qft_circuit(qubits);
+  if (name == "rand")
+    return random_circuit(qubits, depth, 2140);
+  return load_qasm(name);
+}
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+
+#include "harness.h"
+
+#ifdef DISTRIBUTED_BUILD
+#include <mpi.h>
+#endif
+
+#define POWERCAP_DIR "/sys/class/powercap"
+
+// In-process energy measurement from the RAPL counters exposed by the Linux
+// powercap driver. Package and DRAM zones are summed (core, uncore and psys
+// overlap with them). $POWERCAP_DIR replaces /sys/class/powercap, so a fake
+// tree of intel-rapl:*/{name,energy_uj,max_energy_range_uj} files can stand
+// in for testing. Without readable counters the phases are still timed, but
+// energy is reported as unavailable.
+struct EnergyZone {
+  std::string path;
+  long long range;
+};
+
+struct EnergyPhase {
+  std::string name;
+  int count;
+  double joules;
+  double ms;
+};
+
+struct Energy {
+  bool available;
+  std::vector<EnergyZone> zones;
+  std::vector<EnergyPhase> phases;
+  std::vector<long long> start;
+  std::chrono::steady_clock::time_point tstart;
+};
+
+
+// ========================================================================= //
+// -------------------------------- Zones ---------------------------------- //
+// ========================================================================= //
+
+inline bool read_counter(std::string const& path, long long& value) {
+  FILE* file = fopen(path.c_str(), "r");
+  if (!file)
+    return false;
+  bool ok = fscanf(file, "%lld", &value) == 1;
+  fclose(file);
+  return ok;
+}
+
+inline Energy create_energy() {
+  Energy energy;
+  energy.available = false;
+  char const* env = getenv("POWERCAP_DIR");
+  std::string root = env ? env : POWERCAP_DIR;
+
+  DIR* dir = opendir(root.c_str());
+  if (!dir)
+    return energy;
+
+  while (dirent* entry = readdir(dir)) {
+    std::string zone = root + "/" + entry->d_name;
+    if (std::string(entry->d_name).compare(0, 11, "intel-rapl:") != 0)
+      continue;
+
+    char name[64] = "";
+    FILE* file = fopen((zone + "/name").c_str(), "r");
+    if (!file)
+      continue;
+    bool named = fscanf(file, "%63s", name) == 1;
+    fclose(file);
+
+    std::string kind(name);
+    long long value, range;
+    if (!named || (kind.compare(0, 8, "package-") != 0 && kind != "dram"))
+      continue;
+    if (!read_counter(zone + "/energy_uj", value) ||
+        !read_counter(zone + "/max_energy_range_uj", range))
+      continue;
+    energy.zones.push_back({zone + "/energy_uj", range});
+  }
+  closedir(dir);
+
+  energy.available = !energy.zones.empty();
+  return energy;
+}
+
+
+// ========================================================================= //
+// -------------------------------- Phases --------------------------------- //
+// ========================================================================= //
+
+inline void energy_start(Energy& energy) {
+  energy.start.resize(energy.zones.size());
+  for (size_t z = 0; z < energy.zones.size(); z++)
+    if (!read_counter(energy.zones[z].path, energy.start[z]))
+      energy.start[z] = -1;
+  energy.tstart = std::chrono::steady_clock::now();
+}
+
+// Adds the energy and time since energy_start to phase. A counter that went
+// down wrapped around once; phases longer than a full wrap (minutes at
+// package power) are undercounted.
+inline void energy_stop(Energy& energy, std::string const& phase) {
+  auto tstop = std::chrono::steady_clock::now();
+  double uj = 0;
+  for (size_t z = 0; z < energy.zones.size(); z++) {
+    long long value;
+    if (energy.start[z] < 0 || !read_counter(energy.zones[z].path, value))
+      continue;
+    long long delta = value - energy.start[z];
+    uj += delta >= 0 ? delta : delta + energy.zones[z].range;
+  }
+
+  EnergyPhase* p = nullptr;
+  for (auto& q : energy.phases)
+    if (q.name == phase)
+      p = &q;
+  if (!p) {
+    energy.phases.push_back({phase, 0, 0, 0});
+    p = &energy.phases.back();
+  }
+  p->count++;
+  p->joules += uj / 1E6;
+  p->ms += std::chrono::duration<double, std::milli>(tstop - energy.tstart).count();
+}
+
+// energy_stop for a phase run inside harness_run, which leaves out the
+// warmup repetitions
+inline void energy_stop(Energy& energy, std::string const& phase, Harness const& harness) {
+  if (harness.rep >= harness.warmup)
+    energy_stop(energy, phase);
+}
+
+#ifdef DISTRIBUTED_BUILD
+// RAPL counts per node, so one rank per node contributes its counters and the
+// phases are summed over nodes. Every rank must have the same phases.
+inline void energy_reduce(Energy& energy) {
+  MPI_Comm node;
+  int node_rank;
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+  MPI_Comm_rank(node, &node_rank);
+  MPI_Comm_free(&node);
+
+  int zones = node_rank == 0 ? energy.zones.size() : 0;
+  MPI_Allreduce(MPI_IN_PLACE, &zones, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  for (auto& p : energy.phases) {
+    double joules = node_rank == 0 ? p.joules : 0;
+    MPI_Allreduce(MPI_IN_PLACE, &joules, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &p.ms, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    p.joules = joules;
+  }
+  energy.available = zones > 0;
+}
+#endif
+
+
+// ========================================================================= //
+// ------------------------------- Reporting ------------------------------- //
+// ========================================================================= //
+
+// One line per phase with the energy and time of a single run of it, and the
+// average power over it
+inline void energy_print(Energy const& energy, std::ostream& out) {
+  if (!energy.available) {
+    out << "Energy: unavailable" << std::endl;
+    return;
+  }
+  for (auto const& p : energy.phases)
+    out << "Energy " << p.name << ": " << p.joules / p.count << " J, "
+        << p.joules / (p.ms / 1000) << " W" << std::endl;
+}
+
+inline void energy_metrics(Energy const& energy, Harness& harness) {
+  if (!energy.available)
+    return;
+  for (auto const& p : energy.phases) {
+    harness_metric(harness, "energy_" + p.name + "_j", p.joules / p.count);
+    harness_metric(harness, "power_" + p.name + "_w", p.joules / (p.ms / 1000));
+  }
+}
+
+#endif
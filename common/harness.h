@@ -0,0 +1,167 @@
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Shared benchmark harness for the QuEST and ITensor programs: runs warmup
+// untimed repetitions and reps timed ones of a circuit, and appends one JSON
+// record per run (parameters, build info, every timing and their statistics)
+// to json_path, so results do not have to be scraped from logs.
+struct Harness {
+  std::string program;
+  int warmup;
+  int reps;
+  std::string json_path;
+  int rank = 0;
+  int rep = 0;
+  std::vector<std::pair<std::string, std::string>> params;
+  std::vector<std::pair<std::string, std::string>> metrics;
+  std::vector<double> times;
+
+  explicit Harness(std::string const& program, int warmup = 0, int reps = 1, std::string const& json_path = "")
+      : program(program), warmup(warmup), reps(reps), json_path(json_path) {}
+};
+
+
+// ========================================================================= //
+// ------------------------------- Records --------------------------------- //
+// ========================================================================= //
+
+inline std::string json_value(std::string const& value) {
+  std::string quoted = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\')
+      quoted += '\\';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+inline std::string json_value(char const* value) {
+  return json_value(std::string(value));
+}
+
+inline std::string json_value(double value) {
+  if (!std::isfinite(value))
+    return "null";
+  std::ostringstream s;
+  s.precision(17);
+  s << value;
+  return s.str();
+}
+
+inline std::string json_value(long long value) { return std::to_string(value); }
+inline std::string json_value(long value) { return std::to_string(value); }
+inline std::string json_value(int value) { return std::to_string(value); }
+inline std::string json_value(bool value) { return value ? "true" : "false"; }
+
+inline std::string json_value(std::vector<double> const& values) {
+  std::string array = "[";
+  for (size_t i = 0; i < values.size(); i++)
+    array += (i ? "," : "") + json_value(values[i]);
+  return array + "]";
+}
+
+template <class T>
+inline void harness_param(Harness& h, std::string const& key, T const& value) {
+  h.params.push_back({key, json_value(value)});
+}
+
+template <class T>
+inline void harness_metric(Harness& h, std::string const& key, T const& value) {
+  h.metrics.push_back({key, json_value(value)});
+}
+
+
+// ========================================================================= //
+// -------------------------------- Timing --------------------------------- //
+// ========================================================================= //
+
+// Median of values, which must not be empty
+inline double harness_median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  size_t n = values.size();
+  return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+// Calls reset before and body inside each repetition, and records the time
+// of body for the timed ones. h.rep is the current repetition, so the body
+// can tell the warmup ones apart. Returns the median time in ms.
+template <class Reset, class Body>
+inline double harness_run(Harness& h, Reset reset, Body body) {
+  h.times.clear();
+  for (int r = 0; r < h.warmup + h.reps; r++) {
+    h.rep = r;
+    reset();
+    auto tstart = std::chrono::steady_clock::now();
+    body();
+    auto tstop = std::chrono::steady_clock::now();
+    if (r >= h.warmup)
+      h.times.push_back(std::chrono::duration<double, std::milli>(tstop - tstart).count());
+  }
+
+  return harness_median(h.times);
+}
+
+inline int harness_threads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+// Appends the record of the last harness_run to json_path, from rank 0 only
+inline void harness_write(Harness const& h) {
+  if (h.json_path.empty() || h.rank != 0 || h.times.empty())
+    return;
+
+  size_t n = h.times.size();
+  double median = harness_median(h.times);
+  double mean = 0, var = 0;
+  for (double t : h.times)
+    mean += t / n;
+  for (double t : h.times)
+    var += (t - mean) * (t - mean) / std::max<size_t>(n - 1, 1);
+
+  char host[256] = "";
+  gethostname(host, sizeof(host) - 1);
+
+  std::ostringstream s;
+  s << "{\"program\":" << json_value(h.program) << ",\"params\":{";
+  for (size_t i = 0; i < h.params.size(); i++)
+    s << (i ? "," : "") << json_value(h.params[i].first) << ":" << h.params[i].second;
+  s << "},\"build\":{\"compiler\":" << json_value(__VERSION__)
+    << ",\"date\":" << json_value(__DATE__ " " __TIME__)
+#ifdef GIT_COMMIT
+    << ",\"commit\":" << json_value(GIT_COMMIT)
+#endif
+    << ",\"host\":" << json_value(host) << "},\"metrics\":{";
+  for (size_t i = 0; i < h.metrics.size(); i++)
+    s << (i ? "," : "") << json_value(h.metrics[i].first) << ":" << h.metrics[i].second;
+  s << "},\"warmup\":" << h.warmup << ",\"reps\":" << h.reps << ",\"times_ms\":[";
+  for (size_t i = 0; i < h.times.size(); i++)
+    s << (i ? "," : "") << json_value(h.times[i]);
+  s << "],\"min_ms\":" << json_value(*std::min_element(h.times.begin(), h.times.end())) << ",\"median_ms\":" << json_value(median)
+    << ",\"mean_ms\":" << json_value(mean) << ",\"stddev_ms\":" << json_value(std::sqrt(var))
+    << "}";
+
+  std::ofstream out(h.json_path, std::ios::app);
+  out << s.str() << std::endl;
+}
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Usable memory of an ARCHER2 standard node (256 GiB), leaving a tenth to the
+// OS and MPI, the largest job the planner considers, and the injection
+// bandwidth of the node's two 100 Gb/s Slingshot ports
+#define PLAN_NODE_BYTES (0.9 * 256 * 1073741824.0)
+#define PLAN_MAX_NODES 1024
+#define PLAN_NET_BYTES_PER_S 25E9
+
+// Resource planner shared by the QuEST and ITensor programs. A program gives
+// the memory one node needs and the runtime of a job, both as functions of
+// the node count, with the runtime measured by its own calibration run at the
+// current frequency and scaled to the others. plan_configs then scores every
+// (nodes, frequency) pair that fits in memory by energy, which is what the
+// jobs in this repository minimise.
+struct PlanFreq {
+  const char* name;
+  double ghz;
+  double watts;
+  double slowdown;
+};
+
+struct PlanConfig {
+  int nodes;
+  PlanFreq freq;
+  double node_bytes;
+  double ms;
+  double joules;
+};
+
+// The --cpu-freq settings of the jobs. Node power and the slowdown of the
+// memory-bound QuEST programs relative to high are the medians over the runs
+// in results/quest-energy.csv.
+static const PlanFreq plan_freqs[] = {
+  {"low", 1.5, 339, 1.125},
+  {"medium", 2.0, 365, 1.057},
+  {"highm1", 2.0, 366, 1.057},
+  {"high", 2.25, 492, 1.0},
+};
+
+
+// ========================================================================= //
+// ------------------------------- Frequency ------------------------------- //
+// ========================================================================= //
+
+// Frequency this process runs at: $SLURM_CPU_FREQ_REQ as a name or in kHz,
+// or ARCHER2's default of 2 GHz outside a job that sets it
+inline PlanFreq plan_current_freq() {
+  const char* tmp = getenv("SLURM_CPU_FREQ_REQ");
+  std::string req(tmp ? tmp : "medium");
+  std::transform(req.begin(), req.end(), req.begin(), ::tolower);
+
+  for (auto const& f : plan_freqs)
+    if (req == f.name)
+      return f;
+
+  double ghz = atof(req.c_str()) / 1E6;
+  PlanFreq best = plan_freqs[1];
+  for (auto const& f : plan_freqs)
+    if (std::fabs(f.ghz - ghz) < std::fabs(best.ghz - ghz))
+      best = f;
+  return best;
+}
+
+// Time at freq of work that took ms at cal. Memory-bound work follows the
+// measured slowdown, compute-bound work the clock.
+inline double plan_scale(double ms, PlanFreq const& cal, PlanFreq const& freq, bool memory_bound) {
+  if (memory_bound)
+    return ms * freq.slowdown / cal.slowdown;
+  return ms * cal.ghz / freq.ghz;
+}
+
+
+// ========================================================================= //
+// -------------------------------- Configs -------------------------------- //
+// ========================================================================= //
+
+// Every (nodes, frequency) pair, nodes a power of two up to max_nodes, whose
+// node_bytes(nodes) fits on a node, with node_ms(nodes, freq) as its runtime,
+// cheapest in energy first
+template <class Memory, class Runtime>
+inline std::vector<PlanConfig> plan_configs(int max_nodes, Memory node_bytes, Runtime node_ms) {
+  std::vector<PlanConfig> configs;
+  for (int nodes = 1; nodes <= max_nodes; nodes *= 2) {
+    double bytes = node_bytes(nodes);
+    if (bytes > PLAN_NODE_BYTES)
+      continue;
+
+    for (auto const& f : plan_freqs) {
+      double ms = node_ms(nodes, f);
+      configs.push_back({nodes, f, bytes, ms, nodes * f.watts * ms / 1000});
+    }
+  }
+
+  std::stable_sort(configs.begin(), configs.end(), [](PlanConfig const& a, PlanConfig const& b) {
+    return a.joules < b.joules;
+  });
+  return configs;
+}
+
+// Table of configs, as returned by plan_configs for max_nodes
+inline void plan_print(std::ostream& out, std::vector<PlanConfig> const& configs, int max_nodes) {
+  if (configs.empty()) {
+    out << "No configuration fits in " << max_nodes << (max_nodes == 1 ? " node" : " nodes") << " of "
+        << PLAN_NODE_BYTES / 1073741824 << " GiB" << std::endl;
+    return;
+  }
+
+  int min_nodes = configs[0].nodes;
+  for (auto const& c : configs)
+    min_nodes = std::min(min_nodes, c.nodes);
+
+  char line[256];
+  out << "Nodes  Freq     Memory/node (GiB)  Runtime (s)  Energy (kJ)  Node hours" << std::endl;
+  for (auto const& c : configs) {
+    snprintf(line, sizeof(line), "%5d  %-7s  %17.2f  %11.2f  %11.2f  %10.4f", c.nodes, c.freq.name,
+             c.node_bytes / 1073741824, c.ms / 1000, c.joules / 1000, c.nodes * c.ms / 3.6E6);
+    out << line << std::endl;
+  }
+
+  out << "Minimum nodes: " << min_nodes << std::endl;
+  out << "Cheapest: " << configs[0].nodes << " nodes at " << configs[0].freq.name << " ("
+      << configs[0].ms / 1000 << " s, " << configs[0].joules / 1000 << " kJ)" << std::endl;
+}
+
+#endif
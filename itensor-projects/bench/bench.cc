@@ -6,8 +6,18 @@
 #include "itensor/util/print_macro.h"
 #include "../helpers/ops.h"
 #include "../helpers/io.h"
+#include "../helpers/measure.h"
+#include "../helpers/checkpoint.h"
+#include "../helpers/trace.h"
+#include "../helpers/budget.h"
+#include "../helpers/tebd.h"
+#include "../helpers/plan.h"
+#include "../../common/harness.h"
+#include "../../common/energy.h"
+#include "../../common/plan.h"
 
 #include <chrono>
+#include <future>
 
 using namespace itensor;
 using namespace std;
@@ -17,33 +27,146 @@ using namespace std;
 #define CUTOFF_DEFAULT 1E-16
 #define MAXDIM_DEFAULT 1073741824
 #define DEPTH_DEFAULT 16
+#define ENGINE_DEFAULT "mpo"
+#define METHOD_DEFAULT "density"
+#define SEGMENTS_DEFAULT 2
+#define SAMPLES_DEFAULT 0
+#define AMPS_DEFAULT 0
+#define THREADS_DEFAULT 1
+#define CKPT_DEFAULT 0
+#define CKPT_FILE_DEFAULT "bench.ckpt"
+#define SEED 2140
+#define CALIBRATION_DIM 128
+#define CALIBRATION_REPS 4
 
-MPS applyRandomMPS(MPS mps, int depth, int maxdim, double cutoff);
+// Wall time of each overlap sweep, from when both start, and of the two
+// together
+struct OverlapStats {
+    double right_ms;
+    double left_ms;
+    double sweeps_ms;
+};
+
+MPS applyRandomMPS(MPS mps, int first, int depth, int maxdim, double cutoff, string const& method,
+                   TruncationBudget &budget, double &tbuild, int every, string const& path,
+                   CheckpointStats &ckpt);
+MPS applyRandomLocal(MPS mps, int first, int depth, int maxdim, double cutoff, TruncationBudget &budget,
+                     int every, string const& path, CheckpointStats &ckpt);
+MPS applyRandomTEBD(MPS mps, int first, int depth, int maxdim, double cutoff, TruncationBudget &budget,
+                    int threads, int every, string const& path, CheckpointStats &ckpt);
+void precompileRandom(SiteSet sites);
 vector<MPO> constructRandomMPOs(MPS mps, int depth);
-Cplx wideOverlap(MPS left, vector<MPO> mpos, MPS right, int maxdim, double cutoff);
+Cplx wideOverlap(MPS left, vector<MPO> mpos, MPS right, int maxdim, double cutoff, int segments,
+                 OverlapStats &stats);
+void planBench(RunArgs const& args);
 
 int main(int argc, char *argv[]) {
-    int qreg_size = QREG_DEFAULT;
-    string init_state = INIT_DEFAULT;
-    int maxdim = MAXDIM_DEFAULT;
-    double cutoff = CUTOFF_DEFAULT;
-    int depth = DEPTH_DEFAULT;
+    RunArgs args;
+    args.qreg_size = QREG_DEFAULT;
+    args.init_state = INIT_DEFAULT;
+    args.maxdim = MAXDIM_DEFAULT;
+    args.cutoff = CUTOFF_DEFAULT;
+    args.depth = DEPTH_DEFAULT;
+    args.engine = ENGINE_DEFAULT;
+    args.apply_method = METHOD_DEFAULT;
+    args.fidelity = false;
+    args.plan = false;
+    args.gate_cache = true;
+    args.budget = 0;
+    args.segments = SEGMENTS_DEFAULT;
+    args.samples = SAMPLES_DEFAULT;
+    args.amps = AMPS_DEFAULT;
+    args.threads = THREADS_DEFAULT;
+    args.ckpt_every = CKPT_DEFAULT;
+    args.ckpt_path = CKPT_FILE_DEFAULT;
+    args.resume = false;
+    args.warmup = 0;
+    args.reps = 1;
 
-    set_args(argc, argv, qreg_size, init_state, maxdim, cutoff, depth);
+    set_args(argc, argv, args);
     int verbose = set_verbose();
+    if (args.engine != "mpo" && args.engine != "local" && args.engine != "tebd")
+        throw invalid_argument("Unknown engine, please use one of the following: 'mpo', 'local', 'tebd'");
 
-    srand(2140);
+    // Predict the resources of this run instead of simulating it
+    if (args.plan) {
+        planBench(args);
+        return 0;
+    }
+    setGateCache(args.gate_cache);
+    if (!args.trace_path.empty())
+        openTrace(args.trace_path);
 
-    auto init_mps = initMPS(qreg_size, init_state);
-    auto measure_mps = initMPS(qreg_size, "|0..0>");
+    Energy energy = create_energy();
+    energy_start(energy);
+    srand(SEED);
 
-    auto tstart = chrono::steady_clock::now();
+    auto init_mps = initMPS(args.qreg_size, args.init_state);
+    auto measure_mps = initMPS(args.qreg_size, "|0..0>");
+    MPS start_mps = init_mps;
+    MPS result_mps;
+    double tbuild = 0;
+    CheckpointStats ckpt = {0, 0, 0};
 
-    auto result_mps = applyRandomMPS(init_mps, depth, maxdim, cutoff);
+    // Continue from a checkpoint: its MPS carries the site indices, so the
+    // reference states are rebuilt on them, and rand() is replayed up to it
+    int first = 0;
+    long draws = 0;
+    if (args.resume) {
+        first = resumeMPS(args.ckpt_path, start_mps, draws);
+        SiteSet sites = SpinHalf(siteInds(start_mps));
+        init_mps = initMPS(sites, args.init_state);
+        measure_mps = initMPS(sites, "|0..0>");
+        if (verbose)
+            printfln("Resuming from layer %d of %d", first, args.depth);
+    }
+    if (args.engine == "mpo" && args.gate_cache)
+        precompileRandom(SpinHalf(siteInds(start_mps)));
+    energy_stop(energy, "init");
 
-    auto tstop = chrono::steady_clock::now();
-    double tdiff = chrono::duration<double, milli>(tstop - tstart).count();
+    if (verbose && args.engine == "tebd")
+        printfln("Threads: %d", args.threads);
+
+    // A layer truncates at the n - 1 bonds of each of its two MPOs, or at
+    // the bonds of its CROTs with the local and tebd engines
+    int n = length(start_mps);
+    int svds = args.engine == "mpo" ? 2 * (n - 1) : n / 2;
+    TruncationBudget budget = createBudget(args.budget, args.depth - first, svds);
+
+    // Every repetition draws the same circuit, and reports its own build
+    // time, checkpoints and truncation
+    Harness harness("itensor-bench", args.warmup, args.reps, args.json_path);
+    auto reset = [&]() {
+        srand(SEED);
+        for (long d = 0; d < draws; d++)
+            rand();
+        tbuild = 0;
+        ckpt = {0, 0, 0};
+        budget = createBudget(args.budget, args.depth - first, svds);
+    };
+    auto run = [&]() {
+        energy_start(energy);
+        if (args.engine == "mpo")
+            result_mps = applyRandomMPS(start_mps, first, args.depth, args.maxdim, args.cutoff,
+                                        args.apply_method, budget, tbuild, args.ckpt_every,
+                                        args.ckpt_path, ckpt);
+        else if (args.engine == "tebd")
+            result_mps = applyRandomTEBD(start_mps, first, args.depth, args.maxdim, args.cutoff,
+                                         budget, args.threads, args.ckpt_every, args.ckpt_path, ckpt);
+        else
+            result_mps = applyRandomLocal(start_mps, first, args.depth, args.maxdim, args.cutoff,
+                                          budget, args.ckpt_every, args.ckpt_path, ckpt);
+        energy_stop(energy, "circuit", harness);
+    };
+
+    double tdiff = harness_run(harness, reset, run);
     cout << "Full simulation time: " << tdiff << " ms" << endl;
+    cout << "Layer construction time: " << tbuild << " ms" << endl;
+    if (args.depth > first)
+        cout << "Time per layer: " << (tdiff - tbuild) / (args.depth - first) << " ms" << endl;
+    if (ckpt.writes > 0)
+        printfln("Checkpoints: %d writes, %f MB, %f MB/s", ckpt.writes, ckpt.bytes / 1E6,
+                 ckpt.bytes / 1E6 / (ckpt.ms / 1000));
 
     // PrintData(result_mps);
     printfln("Norm: %f", norm(result_mps));
@@ -51,84 +174,415 @@ int main(int argc, char *argv[]) {
     printfln("Avg link dim: %f", averageLinkDim(result_mps));
 
     Cplx amp = innerC(init_mps, result_mps);
-    cout << "Amplitude: " << amp << endl << endl;
+    cout << "Amplitude: " << amp << endl;
+    if (budget.enabled)
+        printfln("Estimated fidelity: %f (budget %f)", budgetFidelity(budget), args.budget);
+
+    // Fidelity against the same circuit applied exactly, with the density
+    // method and neither truncation nor checkpoints
+    double fidelity = -1;
+    if (args.fidelity) {
+        double tref = 0;
+        CheckpointStats none = {0, 0, 0};
+        TruncationBudget exact = createBudget(0, 0, 0);
+        srand(SEED);
+        for (long d = 0; d < draws; d++)
+            rand();
+        MPS exact_mps = args.engine == "mpo"
+            ? applyRandomMPS(start_mps, first, args.depth, MAXDIM_DEFAULT, 0, "density", exact, tref,
+                             0, "", none)
+            : applyRandomLocal(start_mps, first, args.depth, MAXDIM_DEFAULT, 0, exact, 0, "", none);
+        fidelity = std::norm(innerC(exact_mps, result_mps)) /
+            (innerC(exact_mps, exact_mps).real() * innerC(result_mps, result_mps).real());
+        printfln("Fidelity vs exact: %f", fidelity);
+    }
+    cout << endl;
+
+    harness_param(harness, "qubits", args.qreg_size);
+    harness_param(harness, "init", args.init_state);
+    harness_param(harness, "depth", args.depth);
+    harness_param(harness, "engine", args.engine);
+    harness_param(harness, "apply_method", args.apply_method);
+    harness_param(harness, "maxdim", args.maxdim);
+    harness_param(harness, "cutoff", args.cutoff);
+    harness_param(harness, "first_layer", first);
+    harness_param(harness, "threads", args.threads);
+    harness_param(harness, "budget", args.budget);
+    harness_param(harness, "gate_cache", args.gate_cache);
+    harness_metric(harness, "build_ms", tbuild);
+    if (args.depth > first)
+        harness_metric(harness, "layer_ms", (tdiff - tbuild) / (args.depth - first));
+    if (args.fidelity)
+        harness_metric(harness, "fidelity", fidelity);
+    if (budget.enabled)
+        harness_metric(harness, "estimated_fidelity", budgetFidelity(budget));
+    harness_metric(harness, "max_link_dim", maxLinkDim(result_mps));
+    harness_metric(harness, "avg_link_dim", averageLinkDim(result_mps));
+
+    srand(SEED);
+
+    energy_start(energy);
+    auto tstart = chrono::steady_clock::now();
 
-    srand(2140);
+    vector<MPO> random_circuit = constructRandomMPOs(init_mps, args.depth);
 
-    tstart = chrono::steady_clock::now();
+    auto tbuilt = chrono::steady_clock::now();
 
-    vector<MPO> random_circuit = constructRandomMPOs(init_mps, depth);
-    amp = wideOverlap(init_mps, random_circuit, init_mps, maxdim, cutoff);
+    OverlapStats overlap;
+    amp = wideOverlap(init_mps, random_circuit, init_mps, args.maxdim, args.cutoff, args.segments,
+                      overlap);
 
-    tstop = chrono::steady_clock::now();
+    auto tstop = chrono::steady_clock::now();
+    energy_stop(energy, "overlap");
     tdiff = chrono::duration<double, milli>(tstop - tstart).count();
+    tbuild = chrono::duration<double, milli>(tbuilt - tstart).count();
 
     cout << "Overlap time: " << tdiff << " ms" << endl;
+    cout << "Layer construction time: " << tbuild << " ms" << endl;
     cout << "Amplitude: " << amp << endl;
 
+    // Speedup of the two concurrent sweeps over running them one after another
+    double speedup = overlap.sweeps_ms > 0 ? (overlap.right_ms + overlap.left_ms) / overlap.sweeps_ms : 1;
+    printfln("Overlap sweeps: right %f ms, left %f ms, together %f ms (speedup %f)", overlap.right_ms,
+             overlap.left_ms, overlap.sweeps_ms, speedup);
+    harness_metric(harness, "overlap_ms", tdiff);
+    harness_metric(harness, "overlap_speedup", speedup);
+
+    if (args.samples > 0) {
+        mt19937_64 rng(2140);
+        vector<double> probs;
+
+        energy_start(energy);
+        tstart = chrono::steady_clock::now();
+
+        auto samples = sampleMPS(result_mps, args.samples, rng, probs);
+
+        tstop = chrono::steady_clock::now();
+        energy_stop(energy, "sampling");
+        tdiff = chrono::duration<double, milli>(tstop - tstart).count();
+
+        cout << endl << "Sampling time: " << tdiff << " ms" << endl;
+        printfln("Sampling throughput: %f samples/s", args.samples / (tdiff / 1000));
+        printfln("XEB fidelity: %f", xebFidelity(probs, length(result_mps)));
+
+        if (verbose)
+            for (auto const& bits : samples) {
+                for (int b : bits)
+                    cout << b;
+                cout << endl;
+            }
+    }
+
+    if (args.amps > 0) {
+        mt19937_64 rng(2140);
+        vector<vector<int>> bitstrings(args.amps, vector<int>(length(result_mps)));
+        for (auto &bits : bitstrings)
+            for (int &b : bits)
+                b = rng() % 2;
+        long nodes;
+
+        energy_start(energy);
+        tstart = chrono::steady_clock::now();
+
+        auto amps = amplitudesMPS(result_mps, bitstrings, args.threads, nodes);
+
+        tstop = chrono::steady_clock::now();
+        energy_stop(energy, "amplitudes");
+        tdiff = chrono::duration<double, milli>(tstop - tstart).count();
+
+        cout << endl << "Amplitudes time: " << tdiff << " ms" << endl;
+        printfln("Amplitudes throughput: %f amplitudes/s", args.amps / (tdiff / 1000));
+        printfln("Trie nodes: %d (unshared: %d)", nodes, (long) args.amps * length(result_mps));
+
+        if (verbose)
+            for (int k = 0; k < args.amps; k++) {
+                for (int b : bitstrings[k])
+                    cout << b;
+                cout << " " << amps[k] << endl;
+            }
+    }
+
+    if (verbose) {
+        auto stats = gateCacheStats();
+        printfln("Gate cache: %d hits, %d misses", stats.hits, stats.misses);
+    }
+
+    cout << endl;
+    if (verbose)
+        energy_print(energy, cout);
+    energy_metrics(energy, harness);
+    harness_write(harness);
+    closeTrace();
+
     return 0;
 }
 
-MPS applyRandomMPS(MPS mps, int depth, int maxdim, double cutoff) {
+// Applies layers first to depth - 1 with the given MPO application method and
+// adds the time spent building layer MPOs to tbuild. An enabled budget sets
+// the cutoff of every layer. Every every layers (never if 0) the state is
+// checkpointed to path.
+MPS applyRandomMPS(MPS mps, int first, int depth, int maxdim, double cutoff, string const& method,
+                   TruncationBudget &budget, double &tbuild, int every, string const& path,
+                   CheckpointStats &ckpt) {
     SiteSet sites = SpinHalf(siteInds(mps));
-    for (int i = 0; i < depth; i++) {
-        MPO rmpo = MPO(sites); // random MPO layer
+    auto args = Args("MaxDim=", maxdim, "Cutoff=", cutoff);
+    traceBegin(mps);
+    for (int i = first; i < depth; i++) {
+        auto tstart = chrono::steady_clock::now();
+
+        MPO rmpo = layerMPO(sites, randomGates(sites), 0, 1); // random MPO layer
+        MPO empo = popCROT_LAYER(sites, 1 + i % 2, 1); // entangle MPO layer
+
+        auto tstop = chrono::steady_clock::now();
+        tbuild += chrono::duration<double, milli>(tstop - tstart).count();
+
+        auto layer = budgetArgs(budget, mps, args);
+        mps = applyMPOBy(method, rmpo, noPrime(mps), layer);
+        mps = applyMPOBy(method, empo, noPrime(mps), layer);
+        budgetStep(budget, mps);
+        traceStep("layer", i, mps);
+
+        if (every > 0 && (i + 1) % every == 0 && i + 1 < depth)
+            checkpointMPS(path, mps, i + 1, (long) (i + 1) * length(mps), ckpt);
+    }
+
+    return mps;
+}
+
+// Same circuit as applyRandomMPS, with each gate contracted into its own sites
+MPS applyRandomLocal(MPS mps, int first, int depth, int maxdim, double cutoff, TruncationBudget &budget,
+                     int every, string const& path, CheckpointStats &ckpt) {
+    auto args = Args("MaxDim=", maxdim, "Cutoff=", cutoff);
+    traceBegin(mps);
+    for (int i = first; i < depth; i++) {
         for (int j = 1; j <= length(mps); j++)
-            rmpo = nmultMPO(prime(rmpo), popRAND(sites, j));
-        mps = applyMPO(rmpo, noPrime(mps), {"MaxDim=", maxdim, "Cutoff=", cutoff});
-        
-        MPO empo = MPO(sites); // entangle MPO layer
+            applyGate(mps, makeRAND(siteIndex(mps, j)), j);
+
+        auto layer = budgetArgs(budget, mps, args);
         for (int j = 1 + i % 2; j < length(mps); j += 2)
-            empo = nmultMPO(prime(empo), popCROT(sites, j, j + 1, 1));
-        mps = applyMPO(empo, noPrime(mps), {"MaxDim=", maxdim, "Cutoff=", cutoff});
+            applyGate(mps, makeCROT(siteIndex(mps, j), siteIndex(mps, j + 1), 1), j, j + 1, layer);
+        budgetStep(budget, mps);
+        traceStep("layer", i, mps);
+
+        if (every > 0 && (i + 1) % every == 0 && i + 1 < depth)
+            checkpointMPS(path, mps, i + 1, (long) (i + 1) * length(mps), ckpt);
+    }
+
+    return mps;
+}
+
+// Same circuit as applyRandomLocal, TEBD style: the gates of a layer are
+// drawn in order, the single-qubit ones are absorbed into the site tensors
+// and the CROTs, all on bonds of one parity, are applied concurrently on a
+// pool of threads threads started once per run
+MPS applyRandomTEBD(MPS mps, int first, int depth, int maxdim, double cutoff, TruncationBudget &budget,
+                    int threads, int every, string const& path, CheckpointStats &ckpt) {
+    auto args = Args("MaxDim=", maxdim, "Cutoff=", cutoff);
+    int n = length(mps);
+    ThreadPool pool(threads);
+    auto state = toCanonical(mps);
+    fromCanonical(state, mps);
+    traceBegin(mps);
+    for (int i = first; i < depth; i++) {
+        vector<ITensor> rands, crots;
+        for (int j = 1; j <= n; j++)
+            rands.push_back(makeRAND(state.sites[j]));
+        for (int j = 1 + i % 2; j < n; j += 2)
+            crots.push_back(makeCROT(state.sites[j], state.sites[j + 1], 1));
+
+        applySiteGates(state, rands, pool);
+        auto layer = budgetArgs(budget, mps, args);
+        applyBondGates(state, crots, 1 + i % 2, layer, pool);
+        fromCanonical(state, mps);
+        budgetStep(budget, mps);
+        traceStep("layer", i, mps);
+
+        if (every > 0 && (i + 1) % every == 0 && i + 1 < depth)
+            checkpointMPS(path, mps, i + 1, (long) (i + 1) * n, ckpt);
     }
 
     return mps;
 }
 
+// Builds both entangling layers the mpo engine applies, so that they are
+// never built inside the timed region
+void precompileRandom(SiteSet sites) {
+    popCROT_LAYER(sites, 1, 1);
+    popCROT_LAYER(sites, 2, 1);
+}
+
 vector<MPO> constructRandomMPOs(MPS mps, int depth) {
     SiteSet sites = SpinHalf(siteInds(mps));
     vector<MPO> mpos;
 
     for (int i = 0; i < depth; i++) {
-        MPO rmpo = MPO(sites); // random MPO layer
-        for (int j = 1; j <= length(mps); j++){
-            rmpo = nmultMPO(prime(rmpo), popRAND(sites, j));
-            rmpo.mapPrime(2, 1);
-        }
-        
-        MPO empo = MPO(sites); // entangle MPO layer
-        for (int j = 1 + i % 2; j < length(mps); j += 2) {
-            empo = nmultMPO(prime(empo), popCROT(sites, j, j + 1, 1));
-            empo.mapPrime(2, 1);
-        }
-
-        MPO layer = nmultMPO(prime(empo), rmpo);
-        layer.mapPrime(2, 1);
-
+        MPO layer = layerMPO(sites, randomGates(sites), 1 + i % 2, 1);
         mpos.push_back(prime(layer, i));
     }
 
     return(mpos);
 }
 
-Cplx wideOverlap(MPS left, vector<MPO> mpos, MPS right, int maxdim, double cutoff) {
-    SiteSet sites = SpinHalf(siteInds(right));
+// Rough cost of applying count layers to a state whose largest bond is chi:
+// each layer costs chi^3 and grows chi by about sqrt(2) until it hits cap
+double sweepCost(int count, double chi, double cap) {
+    double cost = 0;
+    for (int t = 0; t < count; t++) {
+        cost += chi * chi * chi;
+        chi = min(chi * sqrt(2.0), cap);
+    }
+    return cost;
+}
+
+// The first layers are applied to right and the last ones to left, on two
+// threads, with the split chosen so both sweeps take about the same time.
+// With two segments the two layers in between go into the final overlap.
+// With more, the layers in between are cut into segments - 2 blocks that are
+// folded into one MPO each and merged pairwise beforehand, on this thread,
+// since nmultMPO draws index ids from ITensor's unsynchronised generator. The
+// sweeps use the zip-up method, whose only ids are drawn under a lock.
+Cplx wideOverlap(MPS left, vector<MPO> mpos, MPS right, int maxdim, double cutoff, int segments,
+                 OverlapStats &stats) {
     int depth = mpos.size();
+    auto args = Args("MaxDim=", maxdim, "Cutoff=", cutoff);
     left.prime(depth);
+    stats = {0, 0, 0};
 
     if (depth == 0)
         return inner(left, right);
     if (depth == 1)
         return inner(left, mpos.at(0), right);
 
-    int i, j; // remember values after loops exit
-    for (i = 0; i < (depth - 1) / 2; i++)
-        right = applyMPO(mpos.at(i), right, {"MaxDim=", maxdim, "Cutoff=", cutoff});
-    for (j = depth - 1; j > (depth + 1) / 2; j--) 
-        left = applyMPO(mpos.at(j), left, {"MaxDim=", maxdim, "Cutoff=", cutoff});
-    
-    return innerC(left, mpos.at(j), mpos.at(i), right);
+    int blocks = max(0, min(segments - 2, depth - 2));
+    int middle = blocks > 0 ? max(blocks, depth * blocks / segments) : 2;
+    int outer = depth - middle;
+
+    double cap = min((double) maxdim, pow(2.0, length(right) / 2));
+    int nright = 0;
+    double best = -1;
+    for (int r = 0; r <= outer; r++) {
+        double cost = max(sweepCost(r, maxLinkDim(right), cap),
+                          sweepCost(outer - r, maxLinkDim(left), cap));
+        if (best < 0 || cost < best) {
+            best = cost;
+            nright = r;
+        }
+    }
+    int first = nright;          // first layer not applied to right
+    int last = nright + middle;  // first layer applied to left
+
+    vector<MPO> tree;
+    for (int b = 0; b < blocks; b++) {
+        int lo = first + middle * b / blocks;
+        int hi = first + middle * (b + 1) / blocks;
+        MPO block = mpos.at(lo);
+        for (int i = lo + 1; i < hi; i++)
+            block = nmultMPO(mpos.at(i), block, args);
+        tree.push_back(block);
+    }
+
+    while (tree.size() > 1) {
+        vector<MPO> next;
+        for (size_t b = 0; b + 1 < tree.size(); b += 2)
+            next.push_back(nmultMPO(tree.at(b + 1), tree.at(b), args));
+        if (tree.size() % 2 == 1)
+            next.push_back(tree.back());
+        tree = next;
+    }
+
+    auto tstart = chrono::steady_clock::now();
+    auto since = [&tstart] {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - tstart).count();
+    };
+    auto rsweep = async(launch::async, [&] {
+        for (int i = 0; i < first; i++)
+            right = zipUpApplyMPO(mpos.at(i), right, args);
+        stats.right_ms = since();
+    });
+    for (int i = depth - 1; i >= last; i--)
+        left = zipUpApplyMPO(mpos.at(i), left, args);
+    stats.left_ms = since();
+    rsweep.get();
+    stats.sweeps_ms = since();
+
+    if (blocks == 0)
+        return innerC(left, mpos.at(first + 1), mpos.at(first), right);
+    return innerC(left, tree.at(0), right);
+}
+
+// Prints the memory and runtime of this run at every frequency, and the
+// largest bond dimension whose run fits on a node, leaving out the exact
+// rerun of --fidelity, whose memory is reported on its own. Bonds are taken to double
+// on every other layer up to the cap, the worst case for this circuit, and a
+// two-site update to cost one SVD, scaled as chi^3 from a calibration on this
+// machine. The mpo engine pays for two SVDs per bond and layer, one of them
+// through the CROT MPO's bond of 2, and the overlap that follows the run
+// costs half as much on its two threads. Sampling and amplitudes are left
+// out.
+void planBench(RunArgs const& args) {
+    int n = args.qreg_size;
+    double full = pow(2.0, n / 2);
+    double cap = min((double) args.maxdim, full);
+
+    // Peak memory of the run and of the overlap with the result alongside,
+    // and of the exact rerun of --fidelity, which does not depend on the cap.
+    // The tebd engine holds every bond's contraction and factors of a layer
+    // between its two rounds.
+    auto engineBytes = [&](double chi) {
+        double bytes = 2 * mpsBytes(n, chi);
+        if (args.engine == "mpo")
+            return bytes + envBytes(n, chi, 2) + svdBytes(2 * chi);
+        if (args.engine == "tebd")
+            return bytes + 2 * mpsBytes(n, chi) + args.threads * svdBytes(chi);
+        return bytes + svdBytes(chi);
+    };
+    auto runBytes = [&](double chi) {
+        double overlap = 3 * mpsBytes(n, chi) + 2 * svdBytes(2 * chi);
+        return max(engineBytes(chi), overlap);
+    };
+    double referenceBytes = args.fidelity ? engineBytes(full) + mpsBytes(n, cap) : 0;
+
+    int dim = min((double) CALIBRATION_DIM, cap);
+    double svdMs = calibrateSVD(dim, CALIBRATION_REPS);
+    auto layersMs = [&](string const& engine, double chi) {
+        double ms = 0;
+        for (int t = 0; t < args.depth; t++) {
+            double grown = pow(2.0, t / 2 + 1);
+            int first = engine == "mpo" ? 1 : 1 + t % 2;
+            int step = engine == "mpo" ? 1 : 2;
+            double layer = 0;
+            for (int b = first; b < n; b += step) {
+                double d = min(bondDim(n, b, chi), grown);
+                layer += svdMs * pow(d / dim, 3);
+                if (engine == "mpo")
+                    layer += svdMs * pow(2 * d / dim, 3);
+            }
+            ms += engine == "tebd" ? layer / min(args.threads, max(1, n / 2)) : layer;
+        }
+        return ms;
+    };
+
+    PlanFreq cal = plan_current_freq();
+    double ms = (args.warmup + args.reps) * layersMs(args.engine, cap) + layersMs("mpo", cap) / 2;
+    if (args.fidelity)
+        ms += layersMs(args.engine == "mpo" ? "mpo" : "local", full);
+    auto nodeBytes = [&](int) { return max(runBytes(cap), referenceBytes); };
+    auto nodeMs = [&](int, PlanFreq const& freq) { return plan_scale(ms, cal, freq, false); };
+    auto configs = plan_configs(1, nodeBytes, nodeMs);
+
+    double fits = 0;
+    for (double chi = 1; chi <= full && runBytes(chi) <= PLAN_NODE_BYTES; chi *= 2)
+        fits = chi;
+
+    printfln("Plan for %d qubits, depth %d, engine %s, max dim %d", n, args.depth, args.engine,
+             (long) cap);
+    printfln("Calibration at %s: SVD of a two-site tensor with bonds %d in %f ms", cal.name, dim, svdMs);
+    printfln("MPS at max dim: %f GiB", mpsBytes(n, cap) / 1073741824);
+    printfln("Largest max dim that fits on a node: %d", (long) fits);
+    if (args.fidelity)
+        printfln("Exact reference of --fidelity: %f GiB (%s)", referenceBytes / 1073741824,
+                 referenceBytes <= PLAN_NODE_BYTES ? "fits" : "does not fit");
+    plan_print(cout, configs, 1);
 }
 
 // mps = applyMPO(popRAND(sites, j), mps, {"Cutoff=", cutoff});
@@ -0,0 +1,26 @@
+//
+// 2019 Many Electron Collaboration Summer School
+// ITensor Tutorial
+//
+#include "itensor/all.h"
+#include "itensor/util/print_macro.h"
+#include "../helpers/ops.h"
+
+using namespace itensor;
+using namespace std;
+
+#define CHECK_QUBITS 6
+#define PRECISION 1E-10
+
+// Checks the helpers outside the benchmarks: every input state written by
+// initMPS and initTensor against the gate-based construction, on up to
+// CHECK_QUBITS qubits. Exits with 1 if any check fails.
+int main() {
+    bool valid = checkInitStates(CHECK_QUBITS, PRECISION);
+    if (valid)
+        cout << "Init states valid" << endl;
+    else
+        cout << "Init states invalid" << endl;
+
+    return valid ? 0 : 1;
+}
@@ -0,0 +1,191 @@
+//
+// 2019 Many Electron Collaboration Summer School
+// ITensor Tutorial
+//
+#include "itensor/all.h"
+#include "itensor/util/print_macro.h"
+#include "../helpers/ops.h"
+#include "../helpers/io.h"
+#include "../helpers/trace.h"
+#include "../helpers/hybrid.h"
+#include "../../common/circuit.h"
+#include "../../common/harness.h"
+#include "../../common/energy.h"
+
+using namespace itensor;
+using namespace std;
+
+#define CIRCUIT_DEFAULT "rand"
+#define QREG_DEFAULT 4
+#define INIT_DEFAULT "|0..0>"
+#define CUTOFF_DEFAULT 1E-16
+#define MAXDIM_DEFAULT 1073741824
+#define DEPTH_DEFAULT 16
+#define ENGINE_DEFAULT "local"
+#define SWITCH_DEFAULT 0
+
+ITensor makeOp(CircuitOp const& op, Index const& s);
+ITensor makeOp(CircuitOp const& op, Index const& s, Index const& t);
+vector<ITensor> circuitGates(Circuit const& circuit, MPS const& mps);
+MPS applyCircuit(MPS mps, Circuit const& circuit, vector<ITensor> const& gates, int maxdim, double cutoff);
+
+int main(int argc, char *argv[]) {
+    RunArgs args;
+    args.circuit = CIRCUIT_DEFAULT;
+    args.qreg_size = QREG_DEFAULT;
+    args.init_state = INIT_DEFAULT;
+    args.maxdim = MAXDIM_DEFAULT;
+    args.cutoff = CUTOFF_DEFAULT;
+    args.depth = DEPTH_DEFAULT;
+    args.engine = ENGINE_DEFAULT;
+    args.switch_dim = SWITCH_DEFAULT;
+    args.warmup = 0;
+    args.reps = 1;
+
+    set_args(argc, argv, args);
+    int verbose = set_verbose();
+    if (args.engine != "local" && args.engine != "hybrid")
+        throw invalid_argument("Unknown engine, please use one of the following: 'local', 'hybrid'");
+    if (!args.trace_path.empty())
+        openTrace(args.trace_path);
+
+    // Build the circuit and its gate tensors before any timing
+    Energy energy = create_energy();
+    energy_start(energy);
+    Circuit circuit = load_circuit(args.circuit, args.qreg_size, args.depth);
+    auto init_mps = initMPS(circuit.qubits, args.init_state);
+    auto measure_mps = initMPS(SpinHalf(siteInds(init_mps)), "|0..0>");
+    auto gates = circuitGates(circuit, init_mps);
+    MPS result_mps;
+    energy_stop(energy, "init");
+
+    // The hybrid engine leaves the MPS once its largest bond passes chi
+    int chi = args.switch_dim > 0 ? args.switch_dim : crossoverDim(circuit.qubits);
+    StateVector result_psi;
+    bool dense = false;
+    HybridStats hybrid;
+
+    if (verbose) {
+        printfln("Circuit: %s", args.circuit);
+        printfln("No. qubits: %d", circuit.qubits);
+        printfln("Gates: %d", circuit.ops.size());
+        if (args.engine == "hybrid")
+            printfln("Switch dim: %d", chi);
+    }
+
+    Harness harness("itensor-circuit", args.warmup, args.reps, args.json_path);
+    auto run = [&]() {
+        energy_start(energy);
+        if (args.engine == "hybrid") {
+            result_mps = init_mps;
+            dense = applyHybrid(result_mps, result_psi, circuit, gates, chi,
+                                {"MaxDim=", args.maxdim, "Cutoff=", args.cutoff}, hybrid);
+        } else {
+            result_mps = applyCircuit(init_mps, circuit, gates, args.maxdim, args.cutoff);
+        }
+        energy_stop(energy, "circuit", harness);
+    };
+
+    double tdiff = harness_run(harness, [] {}, run);
+    cout << "Full simulation time: " << tdiff << " ms" << endl;
+
+    Cplx amp;
+    if (dense) {
+        double norm2 = 0;
+        for (auto const& z : result_psi)
+            norm2 += std::norm(z);
+        printfln("Norm: %f", sqrt(norm2));
+        amp = result_psi[0];
+    } else {
+        printfln("Norm: %f", norm(result_mps));
+        printfln("Max link dim: %f", maxLinkDim(result_mps));
+        printfln("Avg link dim: %f", averageLinkDim(result_mps));
+        amp = innerC(measure_mps, result_mps);
+    }
+    cout << "Amplitude of |0..0>: " << amp << endl;
+
+    if (args.engine == "hybrid") {
+        for (auto const& s : hybrid.switches)
+            printfln("Switch to %s after gate %d (max link dim %d)", s.to_dense ? "dense" : "MPS",
+                     s.gate, s.dim);
+        printfln("Time on MPS: %f ms, dense: %f ms, converting: %f ms", hybrid.mps_ms,
+                 hybrid.dense_ms, hybrid.convert_ms);
+    }
+    if (verbose)
+        energy_print(energy, cout);
+
+    harness_param(harness, "circuit", args.circuit);
+    harness_param(harness, "qubits", circuit.qubits);
+    harness_param(harness, "gates", (long) circuit.ops.size());
+    harness_param(harness, "init", args.init_state);
+    harness_param(harness, "engine", args.engine);
+    harness_param(harness, "maxdim", args.maxdim);
+    harness_param(harness, "cutoff", args.cutoff);
+    harness_metric(harness, "amp0_re", amp.real());
+    harness_metric(harness, "amp0_im", amp.imag());
+    if (!dense) {
+        harness_metric(harness, "max_link_dim", maxLinkDim(result_mps));
+        harness_metric(harness, "avg_link_dim", averageLinkDim(result_mps));
+    }
+    if (args.engine == "hybrid") {
+        harness_param(harness, "switch_dim", chi);
+        harness_metric(harness, "switches", (long) hybrid.switches.size());
+        if (!hybrid.switches.empty())
+            harness_metric(harness, "first_switch_gate", hybrid.switches[0].gate);
+        harness_metric(harness, "mps_ms", hybrid.mps_ms);
+        harness_metric(harness, "dense_ms", hybrid.dense_ms);
+        harness_metric(harness, "convert_ms", hybrid.convert_ms);
+    }
+    energy_metrics(energy, harness);
+    harness_write(harness);
+    closeTrace();
+
+    return 0;
+}
+
+ITensor makeOp(CircuitOp const& op, Index const& s) {
+    auto gate = ITensor(s, prime(s));
+    for (int r = 0; r < 2; r++)
+        for (int c = 0; c < 2; c++)
+            gate.set(s = c + 1, prime(s) = r + 1, op.matrix[2 * r + c]);
+    return gate;
+}
+
+// s carries the low bit of the matrix index
+ITensor makeOp(CircuitOp const& op, Index const& s, Index const& t) {
+    auto gate = ITensor(s, t, prime(s), prime(t));
+    for (int r = 0; r < 4; r++)
+        for (int c = 0; c < 4; c++)
+            gate.set(s = c % 2 + 1, t = c / 2 + 1, prime(s) = r % 2 + 1, prime(t) = r / 2 + 1,
+                     op.matrix[4 * r + c]);
+    return gate;
+}
+
+// Gate tensors on the site indices of mps. The swap network of the local
+// engine puts every site index back where it was after each gate, so the
+// tensors stay valid for the whole circuit.
+vector<ITensor> circuitGates(Circuit const& circuit, MPS const& mps) {
+    vector<ITensor> gates;
+    for (auto const& op : circuit.ops)
+        if (op.qubits.size() == 1)
+            gates.push_back(makeOp(op, siteIndex(mps, op.qubits[0] + 1)));
+        else
+            gates.push_back(makeOp(op, siteIndex(mps, op.qubits[0] + 1), siteIndex(mps, op.qubits[1] + 1)));
+
+    return gates;
+}
+
+MPS applyCircuit(MPS mps, Circuit const& circuit, vector<ITensor> const& gates, int maxdim, double cutoff) {
+    auto args = Args("MaxDim=", maxdim, "Cutoff=", cutoff);
+    traceBegin(mps);
+    for (size_t g = 0; g < gates.size(); g++) {
+        auto const& qubits = circuit.ops[g].qubits;
+        if (qubits.size() == 1)
+            applyGate(mps, gates[g], qubits[0] + 1);
+        else
+            applyGate(mps, gates[g], qubits[0] + 1, qubits[1] + 1, args);
+        traceStep("gate", g, mps);
+    }
+
+    return mps;
+}
@@ -0,0 +1,59 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "budget.h"
+
+using namespace std;
+
+
+// ========================================================================= //
+// -------------------------------- Budget --------------------------------- //
+// ========================================================================= //
+
+// Spreads the truncation allowed by a target fidelity over steps steps. A
+// fidelity of 0 disables the budget, and the fixed MaxDim and Cutoff apply.
+TruncationBudget createBudget(double fidelity, int steps, int svds) {
+    if (fidelity < 0 || fidelity >= 1)
+        throw invalid_argument("Fidelity budget must be in (0, 1), or 0 to disable it");
+    bool enabled = fidelity > 0;
+    return {enabled, enabled ? -log(fidelity) : 0, 0, steps, 0, max(1, svds), 1};
+}
+
+// Sets the cutoff for the next step. The rest of the budget is shared between
+// the remaining steps, with this step's share scaled by how saturated the
+// largest bond is (log2 of it over the log2 of its ceiling, MaxDim or
+// 2^(length / 2) if that is smaller), so early steps on a small state
+// truncate little and leave the budget for the later ones.
+// The share is split evenly between the step's SVDs.
+Args budgetArgs(TruncationBudget &budget, MPS const& mps, Args args) {
+    if (!budget.enabled)
+        return args;
+    budget.norm2 = pow(norm(mps), 2);
+
+    int left = max(1, budget.steps - budget.done);
+    double ceiling = max(1, length(mps) / 2);
+    if (args.defined("MaxDim"))
+        ceiling = max(1.0, min(ceiling, log2((double) args.getInt("MaxDim"))));
+    double saturation = min(1.0, max(1.0 / ceiling, log2((double) maxLinkDim(mps)) / ceiling));
+    double share = max(0.0, budget.loss - budget.spent) * saturation / (saturation + left - 1);
+
+    args.add("Cutoff", max(1E-16, -expm1(-share) / budget.svds));
+    return args;
+}
+
+// The gates are unitary, so the norm lost in the step is the weight it
+// discarded
+void budgetStep(TruncationBudget &budget, MPS const& mps) {
+    if (!budget.enabled)
+        return;
+    double norm2 = pow(norm(mps), 2);
+    if (budget.norm2 > 0 && norm2 > 0)
+        budget.spent += max(0.0, log(budget.norm2 / norm2));
+    budget.done++;
+}
+
+// Estimated fidelity of the final state with the exact one, the product of
+// the weights kept by every step
+double budgetFidelity(TruncationBudget const& budget) {
+    return exp(-budget.spent);
+}
@@ -0,0 +1,21 @@
+#include "itensor/all.h"
+#include "itensor/util/print_macro.h"
+
+using namespace itensor;
+
+// Fidelity budget. loss is the budget as -ln(fidelity) and spent the part of
+// it used so far; svds is the number of truncated SVDs in one step.
+struct TruncationBudget {
+    bool enabled;
+    double loss;
+    double spent;
+    int steps;
+    int done;
+    int svds;
+    double norm2;
+};
+
+TruncationBudget createBudget(double fidelity, int steps, int svds);
+Args budgetArgs(TruncationBudget &budget, MPS const& mps, Args args);
+void budgetStep(TruncationBudget &budget, MPS const& mps);
+double budgetFidelity(TruncationBudget const& budget);
@@ -0,0 +1,60 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include "checkpoint.h"
+
+using namespace std;
+
+#define CHECKPOINT_MAGIC 0x4d50534b43 // "CKSPM" as little-endian bytes
+
+
+// ========================================================================= //
+// ------------------------------ Checkpoints ------------------------------ //
+// ========================================================================= //
+
+// Streams mps to path, tensor by tensor, after a header with the number of
+// layers applied so far and the number of rand() draws they used. The file is
+// written next to path and renamed over it, so a job killed mid-write leaves
+// the previous checkpoint intact.
+void checkpointMPS(string const& path, MPS const& mps, int layer, long draws, CheckpointStats &stats) {
+    auto tstart = chrono::steady_clock::now();
+
+    string tmp = path + ".tmp";
+    ofstream s(tmp, ios::binary);
+    if (!s)
+        throw runtime_error("Cannot open checkpoint file '" + tmp + "'");
+
+    long magic = CHECKPOINT_MAGIC;
+    itensor::write(s, magic);
+    itensor::write(s, layer);
+    itensor::write(s, draws);
+    mps.write(s);
+    stats.bytes += s.tellp();
+    s.close();
+
+    if (rename(tmp.c_str(), path.c_str()) != 0)
+        throw runtime_error("Cannot replace checkpoint file '" + path + "'");
+
+    auto tstop = chrono::steady_clock::now();
+    stats.ms += chrono::duration<double, milli>(tstop - tstart).count();
+    stats.writes++;
+}
+
+// Reads a checkpoint written by checkpointMPS into mps and returns its layer
+int resumeMPS(string const& path, MPS &mps, long &draws) {
+    ifstream s(path, ios::binary);
+    if (!s)
+        throw runtime_error("Cannot open checkpoint file '" + path + "'");
+
+    long magic;
+    int layer;
+    itensor::read(s, magic);
+    if (magic != CHECKPOINT_MAGIC)
+        throw runtime_error("'" + path + "' is not an MPS checkpoint");
+    itensor::read(s, layer);
+    itensor::read(s, draws);
+    mps.read(s);
+
+    return layer;
+}
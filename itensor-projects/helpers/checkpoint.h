@@ -0,0 +1,17 @@
+#include "itensor/all.h"
+#include "itensor/util/print_macro.h"
+
+#include <string>
+
+using namespace itensor;
+
+struct CheckpointStats {
+    int writes;
+    double bytes;
+    double ms;
+};
+
+// Checkpoints
+void checkpointMPS(std::string const& path, MPS const& mps, int layer, long draws,
+                   CheckpointStats &stats);
+int resumeMPS(std::string const& path, MPS &mps, long &draws);
@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <mutex>
+#include "itensor/tensor/algs.h"
+#include "factor.h"
+
+using namespace std;
+
+
+// ========================================================================= //
+// ----------------------------- Factorisation ----------------------------- //
+// ========================================================================= //
+
+// SVD of T as a matrix with the indices rows as its rows, truncated like
+// itensor::svd: the smallest singular values are dropped while their weight
+// stays within Cutoff of the total, and always down to MaxDim. Keeps the left
+// singular vectors, column-major, and the singular values.
+Factor factorSVD(ITensor T, vector<Index> const& rows, Args const& args) {
+    vector<Index> inds(rows);
+    long nrows = 1, size = 1;
+    for (auto const& i : rows)
+        nrows *= dim(i);
+    for (auto const& i : T.inds()) {
+        size *= dim(i);
+        if (find(rows.begin(), rows.end(), i) == rows.end())
+            inds.push_back(i);
+    }
+    T.permute(IndexSet(inds));
+
+    CMatrix M(nrows, size / nrows);
+    long e = 0;
+    T.visit([&](Cplx z) {
+        M(e % nrows, e / nrows) = z;
+        e++;
+    });
+
+    CMatrix UU, VV;
+    Vector DD;
+    SVD(M, UU, DD, VV);
+
+    long keep = DD.size();
+    long maxdim = args.getInt("MaxDim", (int) keep);
+    long mindim = max(1, args.getInt("MinDim", 1));
+    Real cutoff = args.getReal("Cutoff", 1E-16);
+    Real total = 0, discarded = 0;
+    for (long k = 0; k < keep; k++)
+        total += DD(k) * DD(k);
+    while (keep > mindim) {
+        Real p = DD(keep - 1) * DD(keep - 1);
+        if (keep <= maxdim && discarded + p > cutoff * total)
+            break;
+        discarded += p;
+        keep--;
+    }
+
+    Factor f = {rows, nrows, vector<Cplx>(nrows * keep), vector<Real>(keep),
+                total > 0 ? discarded / total : 0};
+    for (long k = 0; k < keep; k++) {
+        f.S[k] = DD(k);
+        for (long r = 0; r < nrows; r++)
+            f.U[r + nrows * k] = UU(r, k);
+    }
+    return f;
+}
+
+// New link index of dimension dim. Draws its id under a lock, so threads that
+// only create indices through makeLink never race on the generator.
+Index makeLink(long dim) {
+    static mutex id_lock;
+    lock_guard<mutex> guard(id_lock);
+    return Index(dim, "Link");
+}
+
+// The kept left singular vectors of f as a tensor on its rows and link
+ITensor isometry(Factor const& f, Index const& link) {
+    vector<Index> inds(f.rows);
+    inds.push_back(link);
+    return ITensor(IndexSet(inds), DenseCplx(f.U));
+}
+
+// Splits T into U * T', U an isometry on rows and a new link, and replaces T
+// by T' = dag(U) * T, the singular values times the right singular vectors.
+// Safe to call from several threads on different tensors.
+ITensor splitSVD(ITensor &T, vector<Index> const& rows, Args const& args) {
+    auto f = factorSVD(T, rows, args);
+    auto U = isometry(f, makeLink(f.S.size()));
+    T = dag(U) * T;
+    return U;
+}
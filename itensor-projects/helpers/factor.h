@@ -0,0 +1,24 @@
+#include "itensor/all.h"
+#include "itensor/util/print_macro.h"
+
+#include <vector>
+
+using namespace itensor;
+
+// Truncated SVD that can run on many threads at once. ITensor draws the id of
+// every new Index from one unsynchronised generator, so factorSVD works on
+// the raw storage and creates none; the new bond is attached afterwards by
+// isometry, with a link made by makeLink.
+struct Factor {
+    std::vector<Index> rows;
+    long nrows;
+    std::vector<Cplx> U;
+    std::vector<Real> S;
+    Real truncerr;
+};
+
+// Factorisation
+Factor factorSVD(ITensor T, std::vector<Index> const& rows, Args const& args);
+Index makeLink(long dim);
+ITensor isometry(Factor const& f, Index const& link);
+ITensor splitSVD(ITensor &T, std::vector<Index> const& rows, Args const& args);
@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include "ops.h"
+#include "hybrid.h"
+
+using namespace std;
+
+#define DENSE_MAX_QUBITS 32 // 64 GiB of complex doubles
+
+
+// ========================================================================= //
+// ------------------------------ Conversions ------------------------------ //
+// ========================================================================= //
+
+// Contracts mps into one tensor and reads it out in storage order, which is
+// column-major over the indices: with the sites in order, site 1 is the
+// fastest-moving index and so the lowest bit
+StateVector denseFromMPS(MPS const& mps) {
+    int n = length(mps);
+    vector<Index> sites;
+    for (int i = 1; i <= n; i++)
+        sites.push_back(siteIndex(mps, i));
+
+    auto T = ContractMPS(mps);
+    T.permute(IndexSet(sites));
+
+    StateVector psi;
+    psi.reserve(1LL << n);
+    T.visit([&psi](Cplx z) { psi.push_back(z); });
+    if ((long long) psi.size() != 1LL << n)
+        throw runtime_error("MPS does not contract to a dense state vector");
+
+    return psi;
+}
+
+// Splits psi into an MPS on sites by a left-to-right sequence of truncated
+// SVDs. Gives up and returns false as soon as a bond exceeds limit, before
+// the SVDs of the bonds further in, which are the expensive ones. Otherwise
+// the orthogonality center ends up on the last site.
+bool mpsFromDense(StateVector const& psi, IndexSet const& sites, Args const& args, int limit, MPS &mps) {
+    int n = length(sites);
+    auto rest = ITensor(sites, DenseCplx(psi));
+    MPS res(n);
+    Index link;
+
+    for (int i = 1; i < n; i++) {
+        auto U = i > 1 ? ITensor(link, sites(i)) : ITensor(sites(i));
+        ITensor S, V;
+        svd(rest, U, S, V, args);
+        link = commonIndex(U, S);
+        if (dim(link) > limit)
+            return false;
+        res.set(i, U);
+        rest = S * V;
+    }
+    res.set(n, rest);
+    res.leftLim(n - 1);
+    res.rightLim(n + 1);
+
+    mps = res;
+    return true;
+}
+
+
+// ========================================================================= //
+// --------------------------- Dense gate kernels -------------------------- //
+// ========================================================================= //
+
+// Same loops as the QuEST programs' fused kernels: every group of 2^k
+// amplitudes that differ only in the gate's bits is read, multiplied by the
+// matrix and written back. qubits are ascending with qubits[0] as the low bit
+// of the matrix index.
+void applyDense(StateVector &psi, vector<int> const& qubits, vector<Cplx> const& matrix) {
+    int k = qubits.size();
+    int dim = 1 << k;
+    if (k > 2)
+        throw invalid_argument("Dense gates act on one or two qubits");
+    long long groups = (long long) psi.size() >> k;
+
+    vector<long long> offsets(dim, 0);
+    for (int j = 0; j < dim; j++)
+        for (int b = 0; b < k; b++)
+            if (j >> b & 1)
+                offsets[j] |= 1LL << qubits[b];
+
+# pragma omp parallel for schedule(static)
+    for (long long g = 0; g < groups; g++) {
+        // Spread g over the bits not used by the gate
+        long long base = g;
+        for (int b = 0; b < k; b++) {
+            long long low = base & ((1LL << qubits[b]) - 1);
+            base = (base - low) << 1 | low;
+        }
+
+        Cplx in[4], out[4];
+        for (int j = 0; j < dim; j++)
+            in[j] = psi[base + offsets[j]];
+        for (int r = 0; r < dim; r++) {
+            out[r] = 0;
+            for (int c = 0; c < dim; c++)
+                out[r] += matrix[r * dim + c] * in[c];
+        }
+        for (int j = 0; j < dim; j++)
+            psi[base + offsets[j]] = out[j];
+    }
+}
+
+
+// ========================================================================= //
+// ----------------------------- Hybrid runner ----------------------------- //
+// ========================================================================= //
+
+// Bond dimension at which a two-site MPS gate (an SVD of a 2chi x 2chi matrix,
+// about 20 (2chi)^3 flops) costs as much as a dense gate (about 4 complex
+// multiply-adds, 32 flops, per amplitude)
+int crossoverDim(int nqubits) {
+    double dense = 32 * pow(2.0, nqubits);
+    return max(2, (int) (cbrt(dense / 20) / 2));
+}
+
+// Runs circuit on mps with the local engine until a two-site gate pushes the
+// largest bond above chi, then contracts it into psi and continues with the
+// dense kernels. From then on the state is split back into an MPS every n
+// gates, doubling the interval after each failed try. A try fails at the
+// first bond above chi / 2, so the runner does not flip-flop at the
+// threshold. Circuits above DENSE_MAX_QUBITS stay on the MPS. gates are the
+// circuit's tensors on the sites of mps. Returns whether the final state is
+// psi (true) or mps (false).
+bool applyHybrid(MPS &mps, StateVector &psi, Circuit const& circuit, vector<ITensor> const& gates,
+                 int chi, Args const& args, HybridStats &stats) {
+    int n = circuit.qubits;
+    IndexSet sites = siteInds(mps);
+    bool dense = false;
+    bool fits = n <= DENSE_MAX_QUBITS;
+    long interval = n, next = 0;
+    stats = {{}, 0, 0, 0};
+
+    auto tmark = chrono::steady_clock::now();
+    auto lap = [&tmark](double &ms) {
+        auto tnow = chrono::steady_clock::now();
+        ms += chrono::duration<double, milli>(tnow - tmark).count();
+        tmark = tnow;
+    };
+
+    for (size_t g = 0; g < gates.size(); g++) {
+        auto const& op = circuit.ops[g];
+
+        if (!dense) {
+            if (op.qubits.size() == 1)
+                applyGate(mps, gates[g], op.qubits[0] + 1);
+            else
+                applyGate(mps, gates[g], op.qubits[0] + 1, op.qubits[1] + 1, args);
+
+            int dim = maxLinkDim(mps);
+            if (fits && op.qubits.size() == 2 && dim > chi && g + 1 < gates.size()) {
+                lap(stats.mps_ms);
+                psi = denseFromMPS(mps);
+                lap(stats.convert_ms);
+                stats.switches.push_back({(long) g + 1, dim, true});
+                dense = true;
+                interval = n;
+                next = g + 1 + interval;
+            }
+        } else {
+            applyDense(psi, op.qubits, op.matrix);
+
+            if ((long) g + 1 == next && g + 1 < gates.size()) {
+                lap(stats.dense_ms);
+                if (mpsFromDense(psi, sites, args, chi / 2, mps)) {
+                    int dim = maxLinkDim(mps);
+                    psi = StateVector();
+                    stats.switches.push_back({(long) g + 1, dim, false});
+                    dense = false;
+                } else {
+                    interval *= 2;
+                    next = g + 1 + interval;
+                }
+                lap(stats.convert_ms);
+            }
+        }
+    }
+    lap(dense ? stats.dense_ms : stats.mps_ms);
+
+    return dense;
+}
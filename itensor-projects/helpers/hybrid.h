@@ -0,0 +1,35 @@
+#include "itensor/all.h"
+#include "itensor/util/print_macro.h"
+
+#include <vector>
+#include "../../common/circuit.h"
+
+using namespace itensor;
+
+// Dense state vectors, with qubit q (site q + 1) as bit q of the index
+typedef std::vector<Cplx> StateVector;
+
+// Conversions
+StateVector denseFromMPS(MPS const& mps);
+bool mpsFromDense(StateVector const& psi, IndexSet const& sites, Args const& args, int limit, MPS &mps);
+
+// Dense gate kernels
+void applyDense(StateVector &psi, std::vector<int> const& qubits, std::vector<Cplx> const& matrix);
+
+// Hybrid runner
+struct HybridSwitch {
+    long gate;
+    int dim;
+    bool to_dense;
+};
+
+struct HybridStats {
+    std::vector<HybridSwitch> switches;
+    double mps_ms;
+    double dense_ms;
+    double convert_ms;
+};
+
+int crossoverDim(int nqubits);
+bool applyHybrid(MPS &mps, StateVector &psi, Circuit const& circuit, std::vector<ITensor> const& gates,
+                 int chi, Args const& args, HybridStats &stats);
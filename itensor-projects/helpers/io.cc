@@ -4,30 +4,70 @@
 
 using namespace std;
 
-void set_args(int argc, char *argv[], int &qreg_size, string &init_state, int &maxdim, double &cutoff, int &depth) {
+#include "io.h"
+
+void set_args(int argc, char *argv[], RunArgs &args) {
     for (int i = 1; i < argc; i++) {
         string arg = argv[i];
-        if (arg == "--nq") {
-            qreg_size = atoi(argv[++i]);
+        if (arg == "--circuit") {
+            args.circuit = argv[++i];
+        } else if (arg == "--nq") {
+            args.qreg_size = atoi(argv[++i]);
         } else if (arg == "--init") {
-            init_state = argv[++i];
+            args.init_state = argv[++i];
         } else if (arg == "--maxd") {
-            maxdim = atoi(argv[++i]);
+            args.maxdim = atoi(argv[++i]);
         } else if (arg == "--cut") {
-            cutoff = atof(argv[++i]);
+            args.cutoff = atof(argv[++i]);
         } else if (arg == "--dep") {
-            depth = atoi(argv[++i]);
+            args.depth = atoi(argv[++i]);
+        } else if (arg == "--engine") {
+            args.engine = argv[++i];
+        } else if (arg == "--samples") {
+            args.samples = atoi(argv[++i]);
+        } else if (arg == "--amps") {
+            args.amps = atoi(argv[++i]);
+        } else if (arg == "--threads") {
+            args.threads = atoi(argv[++i]);
+        } else if (arg == "--ckpt") {
+            args.ckpt_every = atoi(argv[++i]);
+        } else if (arg == "--ckpt-file") {
+            args.ckpt_path = argv[++i];
+        } else if (arg == "--resume") {
+            args.resume = true;
+        } else if (arg == "--warmup") {
+            args.warmup = atoi(argv[++i]);
+        } else if (arg == "--reps") {
+            args.reps = atoi(argv[++i]);
+        } else if (arg == "--json") {
+            args.json_path = argv[++i];
+        } else if (arg == "--trace") {
+            args.trace_path = argv[++i];
+        } else if (arg == "--switch") {
+            args.switch_dim = atoi(argv[++i]);
+        } else if (arg == "--apply-method") {
+            args.apply_method = argv[++i];
+        } else if (arg == "--fidelity") {
+            args.fidelity = true;
+        } else if (arg == "--budget") {
+            args.budget = atof(argv[++i]);
+        } else if (arg == "--aqft-k") {
+            args.aqft_k = atoi(argv[++i]);
+        } else if (arg == "--plan") {
+            args.plan = true;
+        } else if (arg == "--seg") {
+            args.segments = atoi(argv[++i]);
+        } else if (arg == "--no-cache") {
+            args.gate_cache = false;
         } else {
             string message = "Error: Unknown argument '" + arg + 
                 "'! Use: ./bin --nq $NQUBITS --cut $CUTOFF";
             throw invalid_argument(message);
         }
     }
-}
 
-void set_args(int argc, char *argv[], int &qreg_size, string &init_state, int &maxdim, double &cutoff) {
-    int depth;
-    set_args(argc, argv, qreg_size, init_state, maxdim, cutoff, depth);
+    if (args.warmup < 0 || args.reps < 1)
+        throw invalid_argument("Error: --warmup must be at least 0 and --reps at least 1");
 }
 
 int set_verbose() {
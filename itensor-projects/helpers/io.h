@@ -1,5 +1,32 @@
 #include <string>
 
-void set_args(int argc, char *argv[], int &qreg_size, string &init_state, int &maxdim, double &cutoff, int &depth);
-void set_args(int argc, char *argv[], int &qreg_size, string &init_state, int &maxdim, double &cutoff);
+struct RunArgs {
+    string circuit;
+    int qreg_size;
+    string init_state;
+    int maxdim;
+    double cutoff;
+    int depth;
+    string engine;
+    bool gate_cache;
+    int segments;
+    int samples;
+    int amps;
+    int threads;
+    int ckpt_every;
+    string ckpt_path;
+    bool resume;
+    int warmup;
+    int reps;
+    string json_path;
+    string trace_path;
+    int switch_dim;
+    string apply_method;
+    bool fidelity;
+    double budget;
+    int aqft_k;
+    bool plan;
+};
+
+void set_args(int argc, char *argv[], RunArgs &args);
 int set_verbose();
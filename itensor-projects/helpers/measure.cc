@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <future>
+#include <random>
+#include <vector>
+#include "measure.h"
+
+using namespace std;
+
+
+// ========================================================================= //
+// ------------------------------- Sampling -------------------------------- //
+// ========================================================================= //
+
+// Draws count bitstrings (0/1 per site) from the Born distribution of mps and
+// stores the probability of each in probs. With the orthogonality center on
+// site 1, everything right of the current site contracts to the identity, so
+// each conditional needs only the left environment of the bits drawn so far.
+// The two projections of every site tensor are computed once and shared by
+// all samples, so each sample costs O(n chi^2).
+vector<vector<int>> sampleMPS(MPS mps, int count, mt19937_64 &rng, vector<double> &probs) {
+    int n = length(mps);
+    mps.position(1);
+    mps.normalize();
+
+    vector<vector<ITensor>> slices(n + 1);
+    for (int j = 1; j <= n; j++) {
+        auto s = siteIndex(mps, j);
+        slices[j] = {mps(j) * setElt(s = 1), mps(j) * setElt(s = 2)};
+    }
+
+    uniform_real_distribution<double> uniform(0.0, 1.0);
+    vector<vector<int>> samples;
+    probs.clear();
+
+    for (int c = 0; c < count; c++) {
+        vector<int> bits(n);
+        double prob = 1;
+        auto env = ITensor(1.0);
+
+        for (int j = 1; j <= n; j++) {
+            auto A0 = env * slices[j][0];
+            auto A1 = env * slices[j][1];
+            double p0 = pow(norm(A0), 2);
+            double p1 = pow(norm(A1), 2);
+
+            int bit = uniform(rng) * (p0 + p1) < p0 ? 0 : 1;
+            double p = bit == 0 ? p0 : p1;
+            env = bit == 0 ? A0 : A1;
+            env /= sqrt(p);
+
+            bits[j - 1] = bit;
+            prob *= p / (p0 + p1);
+        }
+
+        samples.push_back(bits);
+        probs.push_back(prob);
+    }
+
+    return samples;
+}
+
+// Linear cross-entropy benchmark 2^n <p(x)> - 1 over the sampled bitstrings
+double xebFidelity(vector<double> const& probs, int nqubits) {
+    double mean = 0;
+    for (double p : probs)
+        mean += p;
+    mean /= probs.size();
+
+    return pow(2.0, nqubits) * mean - 1;
+}
+
+
+// ========================================================================= //
+// ------------------------------ Amplitudes ------------------------------- //
+// ========================================================================= //
+
+struct TrieWalk {
+    vector<vector<ITensor>> slices;
+    vector<vector<int>> const* bitstrings;
+    vector<int> order;
+    vector<Cplx> amps;
+    atomic<long> nodes;
+    int spawn_depth;
+};
+
+// Evaluates the sorted bitstrings order[lo, hi), which all share their first
+// j - 1 bits, given the left environment env of that shared prefix. Each trie
+// node costs one O(chi^2) contraction no matter how many bitstrings pass it.
+static void walkTrie(TrieWalk &walk, int j, int lo, int hi, ITensor const& env) {
+    int n = walk.slices.size() - 1;
+    if (j > n) {
+        auto amp = eltC(env);
+        for (int k = lo; k < hi; k++)
+            walk.amps[walk.order[k]] = amp;
+        return;
+    }
+
+    auto const& bitstrings = *walk.bitstrings;
+    int mid = lo;
+    while (mid < hi && bitstrings[walk.order[mid]][j - 1] == 0)
+        mid++;
+
+    future<void> branch;
+    if (mid > lo && mid < hi && j <= walk.spawn_depth)
+        branch = async(launch::async, [&walk, j, mid, hi, &env] {
+            walk.nodes++;
+            walkTrie(walk, j + 1, mid, hi, env * walk.slices[j][1]);
+        });
+    else if (mid < hi) {
+        walk.nodes++;
+        walkTrie(walk, j + 1, mid, hi, env * walk.slices[j][1]);
+    }
+
+    if (mid > lo) {
+        walk.nodes++;
+        walkTrie(walk, j + 1, lo, mid, env * walk.slices[j][0]);
+    }
+
+    if (branch.valid())
+        branch.get();
+}
+
+// Amplitudes <bits|mps> of a batch of bitstrings (0/1 per site). The batch is
+// sorted into a prefix trie so shared prefixes share their left environments,
+// and the cost scales with the number of trie nodes (returned in nodes)
+// instead of bitstrings x n. Subtrees near the root are split across threads.
+vector<Cplx> amplitudesMPS(MPS const& mps, vector<vector<int>> const& bitstrings, int threads, long &nodes) {
+    int n = length(mps);
+    TrieWalk walk;
+    walk.bitstrings = &bitstrings;
+    walk.amps.resize(bitstrings.size());
+    walk.nodes = 0;
+    walk.spawn_depth = 0;
+    while ((1 << walk.spawn_depth) < threads && walk.spawn_depth < n)
+        walk.spawn_depth++;
+
+    walk.slices.resize(n + 1);
+    for (int j = 1; j <= n; j++) {
+        auto s = siteIndex(mps, j);
+        walk.slices[j] = {mps(j) * setElt(s = 1), mps(j) * setElt(s = 2)};
+    }
+
+    for (size_t k = 0; k < bitstrings.size(); k++)
+        walk.order.push_back(k);
+    sort(walk.order.begin(), walk.order.end(), [&bitstrings](int a, int b) {
+        return bitstrings[a] < bitstrings[b];
+    });
+
+    walkTrie(walk, 1, 0, bitstrings.size(), ITensor(1.0));
+
+    nodes = walk.nodes;
+    return walk.amps;
+}
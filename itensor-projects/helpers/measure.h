@@ -0,0 +1,14 @@
+#include "itensor/all.h"
+#include "itensor/util/print_macro.h"
+
+#include <random>
+
+using namespace itensor;
+
+// Sampling
+std::vector<std::vector<int>> sampleMPS(MPS mps, int count, std::mt19937_64 &rng, std::vector<double> &probs);
+double xebFidelity(std::vector<double> const& probs, int nqubits);
+
+// Amplitudes
+std::vector<Cplx> amplitudesMPS(MPS const& mps, std::vector<std::vector<int>> const& bitstrings,
+                                int threads, long &nodes);
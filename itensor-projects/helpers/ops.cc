@@ -1,6 +1,14 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <mutex>
 #include <stdexcept>
+#include <tuple>
 #include <vector>
 #include "ops.h"
+#include "factor.h"
 
 using namespace std;
 
@@ -23,10 +31,66 @@ ITensor makeCROT(Index const& s, Index const& t, int k) {
     CROT.set(s = 1, t = 1, prime(s) = 1, prime(t) = 1, 1.0);
     CROT.set(s = 1, t = 2, prime(s) = 1, prime(t) = 2, 1.0);
     CROT.set(s = 2, t = 1, prime(s) = 2, prime(t) = 1, 1.0);
-    CROT.set(s = 2, t = 2, prime(s) = 2, prime(t) = 2, exp(1_i * Pi / (1 << k)));
+    CROT.set(s = 2, t = 2, prime(s) = 2, prime(t) = 2, exp(1_i * Pi / ldexp(1.0, k)));
     return CROT;
 }
 
+ITensor makeSX(Index const& s) {
+    auto SX = ITensor(s, prime(s));
+    SX.set(s = 1, prime(s) = 1, 0.5 * (1 + Cplx_i));
+    SX.set(s = 2, prime(s) = 1, 0.5 * (1 - Cplx_i));
+    SX.set(s = 1, prime(s) = 2, 0.5 * (1 - Cplx_i));
+    SX.set(s = 2, prime(s) = 2, 0.5 * (1 + Cplx_i));
+    return SX;
+}
+
+ITensor makeSY(Index const& s) {
+    auto SY = ITensor(s, prime(s));
+    SY.set(s = 1, prime(s) = 1, 0.5 * (1 + Cplx_i));
+    SY.set(s = 2, prime(s) = 1, -0.5 * (1 + Cplx_i));
+    SY.set(s = 1, prime(s) = 2, 0.5 * (1 + Cplx_i));
+    SY.set(s = 2, prime(s) = 2, 0.5 * (1 + Cplx_i));
+    return SY;
+}
+
+ITensor makeSW(Index const& s) {
+    auto SW = ITensor(s, prime(s));
+    SW.set(s = 1, prime(s) = 1, 0.5 * (1 + Cplx_i));
+    SW.set(s = 2, prime(s) = 1, 1 / sqrt(2));
+    SW.set(s = 1, prime(s) = 2, -Cplx_i / sqrt(2));
+    SW.set(s = 2, prime(s) = 2, 0.5 * (1 + Cplx_i));
+    return SW;
+}
+
+// Draws from rand() exactly like popRAND, so both paths build the same circuit
+ITensor makeRAND(Index const& s) {
+    int r = rand() % 3;
+    if (r == 0)
+        return makeSX(s);
+    else if (r == 1)
+        return makeSY(s);
+    else
+        return makeSW(s);
+}
+
+ITensor makeCNOT(Index const& c, Index const& t) {
+    auto CNOT = ITensor(c, t, prime(c), prime(t));
+    CNOT.set(c = 1, t = 1, prime(c) = 1, prime(t) = 1, 1.0);
+    CNOT.set(c = 1, t = 2, prime(c) = 1, prime(t) = 2, 1.0);
+    CNOT.set(c = 2, t = 1, prime(c) = 2, prime(t) = 2, 1.0);
+    CNOT.set(c = 2, t = 2, prime(c) = 2, prime(t) = 1, 1.0);
+    return CNOT;
+}
+
+ITensor makeSWAP(Index const& s, Index const& t) {
+    auto SWAP = ITensor(s, t, prime(s), prime(t));
+    SWAP.set(s = 1, t = 1, prime(s) = 1, prime(t) = 1, 1.0);
+    SWAP.set(s = 1, t = 2, prime(s) = 2, prime(t) = 1, 1.0);
+    SWAP.set(s = 2, t = 1, prime(s) = 1, prime(t) = 2, 1.0);
+    SWAP.set(s = 2, t = 2, prime(s) = 2, prime(t) = 2, 1.0);
+    return SWAP;
+}
+
 ITensor makeQFT_STEP(IndexSet indices, int which) {
     auto QFT_STEP = makeH(prime(indices[which - 1], which - 1));
     for (int i = which; i < indices.size(); i++)
@@ -35,42 +99,96 @@ ITensor makeQFT_STEP(IndexSet indices, int which) {
 }
 
 
+// ========================================================================= //
+// ------------------------------- Gate cache ------------------------------ //
+// ========================================================================= //
+
+// Keyed by (gate type, SiteSet identity, site1, site2, k); the identity of a
+// SiteSet is the id of its first site index, which survives SpinHalf(siteInds())
+typedef tuple<string, unsigned long long, int, int, int> GateKey;
+
+static map<GateKey, MPO> gate_cache;
+static GateCacheStats gate_cache_stats = {0, 0};
+static bool gate_cache_enabled = true;
+static mutex gate_cache_mutex;
+
+static MPO cachedMPO(string type, SiteSet const& sites, int site1, int site2, int k,
+                     function<MPO()> build) {
+    if (!gate_cache_enabled)
+        return build();
+
+    auto key = GateKey(type, sites(1).id(), site1, site2, k);
+    lock_guard<mutex> lock(gate_cache_mutex);
+    auto it = gate_cache.find(key);
+    if (it != gate_cache.end()) {
+        gate_cache_stats.hits++;
+        return it->second;
+    }
+
+    gate_cache_stats.misses++;
+    return gate_cache[key] = build();
+}
+
+void setGateCache(bool enabled) {
+    gate_cache_enabled = enabled;
+}
+
+void clearGateCache() {
+    lock_guard<mutex> lock(gate_cache_mutex);
+    gate_cache.clear();
+    gate_cache_stats = {0, 0};
+}
+
+GateCacheStats gateCacheStats() {
+    lock_guard<mutex> lock(gate_cache_mutex);
+    return gate_cache_stats;
+}
+
+
 // ========================================================================= //
 // ------------------------------- MPO gates ------------------------------- //
 // ========================================================================= //
 
 MPO popH(SiteSet sites, int target) {
-    auto ampo = AutoMPO(sites);
-    ampo += sqrt(2), "Sx", target;
-    ampo += sqrt(2), "Sz", target;
-    return toMPO(ampo);
+    return cachedMPO("H", sites, target, 0, 0, [&] {
+        auto ampo = AutoMPO(sites);
+        ampo += sqrt(2), "Sx", target;
+        ampo += sqrt(2), "Sz", target;
+        return toMPO(ampo);
+    });
 }
 
 MPO popSX(SiteSet sites, int target) {
-    auto ampo = AutoMPO(sites);
-    ampo += 0.5 * (1 + Cplx_i), "projUp", target;
-    ampo += 0.5 * (1 - Cplx_i), "S+", target;
-    ampo += 0.5 * (1 - Cplx_i), "S-", target;
-    ampo += 0.5 * (1 + Cplx_i), "projDn", target;
-    return toMPO(ampo);
+    return cachedMPO("SX", sites, target, 0, 0, [&] {
+        auto ampo = AutoMPO(sites);
+        ampo += 0.5 * (1 + Cplx_i), "projUp", target;
+        ampo += 0.5 * (1 - Cplx_i), "S+", target;
+        ampo += 0.5 * (1 - Cplx_i), "S-", target;
+        ampo += 0.5 * (1 + Cplx_i), "projDn", target;
+        return toMPO(ampo);
+    });
 }
 
 MPO popSY(SiteSet sites, int target) {
-    auto ampo = AutoMPO(sites);
-    ampo += 0.5 * (1 + Cplx_i), "projUp", target;
-    ampo += -0.5 * (1 + Cplx_i), "S+", target;
-    ampo += 0.5 * (1 + Cplx_i), "S-", target;
-    ampo += 0.5 * (1 + Cplx_i), "projDn", target;
-    return toMPO(ampo);
+    return cachedMPO("SY", sites, target, 0, 0, [&] {
+        auto ampo = AutoMPO(sites);
+        ampo += 0.5 * (1 + Cplx_i), "projUp", target;
+        ampo += -0.5 * (1 + Cplx_i), "S+", target;
+        ampo += 0.5 * (1 + Cplx_i), "S-", target;
+        ampo += 0.5 * (1 + Cplx_i), "projDn", target;
+        return toMPO(ampo);
+    });
 }
 
 MPO popSW(SiteSet sites, int target) {
-    auto ampo = AutoMPO(sites);
-    ampo += 0.5 * (1 + Cplx_i), "projUp", target;
-    ampo += 1 / sqrt(2), "S+", target;
-    ampo += -Cplx_i / sqrt(2), "S-", target;
-    ampo += 0.5 * (1 + Cplx_i), "projDn", target;
-    return toMPO(ampo);
+    return cachedMPO("SW", sites, target, 0, 0, [&] {
+        auto ampo = AutoMPO(sites);
+        ampo += 0.5 * (1 + Cplx_i), "projUp", target;
+        ampo += 1 / sqrt(2), "S+", target;
+        ampo += -Cplx_i / sqrt(2), "S-", target;
+        ampo += 0.5 * (1 + Cplx_i), "projDn", target;
+        return toMPO(ampo);
+    });
 }
 
 MPO popRAND(SiteSet sites, int target) {
@@ -84,27 +202,314 @@ MPO popRAND(SiteSet sites, int target) {
 }
 
 MPO popCNOT(SiteSet sites, int control, int target) {
-    auto ampo = AutoMPO(sites);
-    ampo += 1, "projUp", control;
-    ampo += 2, "projDn", control, "Sx", target;
-    return toMPO(ampo);
+    return cachedMPO("CNOT", sites, control, target, 0, [&] {
+        auto ampo = AutoMPO(sites);
+        ampo += 1, "projUp", control;
+        ampo += 2, "projDn", control, "Sx", target;
+        return toMPO(ampo);
+    });
 }
 
 MPO popSWAP(SiteSet sites, int target1, int target2) {
-    auto ampo = AutoMPO(sites);
-    ampo += 1, "projUp", target1, "projUp", target2;
-    ampo += 1, "S+", target1, "S-", target2;
-    ampo += 1, "S-", target1, "S+", target2;
-    ampo += 1, "projDn", target1, "projDn", target2;
-    return toMPO(ampo);
+    return cachedMPO("SWAP", sites, target1, target2, 0, [&] {
+        auto ampo = AutoMPO(sites);
+        ampo += 1, "projUp", target1, "projUp", target2;
+        ampo += 1, "S+", target1, "S-", target2;
+        ampo += 1, "S-", target1, "S+", target2;
+        ampo += 1, "projDn", target1, "projDn", target2;
+        return toMPO(ampo);
+    });
 }
 
 MPO popCROT(SiteSet sites, int control, int target, int k) {
-    auto ampo = AutoMPO(sites);
-    ampo += 1, "projUp", control;
-    ampo += 1, "projDn", control, "projUp", target;
-    ampo += exp(Cplx_i * Pi / (1 << k)), "projDn", control, "projDn", target;
-    return toMPO(ampo);
+    return cachedMPO("CROT", sites, control, target, k, [&] {
+        auto ampo = AutoMPO(sites);
+        ampo += 1, "projUp", control;
+        ampo += 1, "projDn", control, "projUp", target;
+        ampo += exp(Cplx_i * Pi / ldexp(1.0, k)), "projDn", control, "projDn", target;
+        return toMPO(ampo);
+    });
+}
+
+
+// ========================================================================= //
+// --------------------------- Local gate engine --------------------------- //
+// ========================================================================= //
+
+// Single-site gates are unitary, so the orthogonality limits stay valid
+void applyGate(MPS &mps, ITensor const& gate, int site) {
+    int ll = mps.leftLim();
+    int rl = mps.rightLim();
+    mps.set(site, noPrime(mps(site) * gate));
+    mps.leftLim(ll);
+    mps.rightLim(rl);
+}
+
+// Contracts sites b and b+1 (and the gate, if given) and splits them again with
+// a truncated SVD. The orthogonality center must be on b or b+1 and ends up on
+// b+1 (Fromleft) or b (Fromright). With swap set, the two site indices trade
+// places, so a swap costs no extra contraction on top of the gate.
+Spectrum applyBondGate(MPS &mps, int b, ITensor const& gate, Args const& args, Direction dir, bool swap) {
+    auto sl = siteIndex(mps, swap ? b + 1 : b);
+    auto wf = mps(b) * mps(b + 1);
+    if (gate)
+        wf = noPrime(wf * gate);
+
+    auto U = b > 1 ? ITensor(leftLinkIndex(mps, b), sl) : ITensor(sl);
+    ITensor S, V;
+    auto spec = svd(wf, U, S, V, args);
+
+    if (dir == Fromleft) {
+        mps.set(b, U);
+        mps.set(b + 1, S * V);
+        mps.leftLim(b);
+        mps.rightLim(b + 2);
+    } else {
+        mps.set(b, U * S);
+        mps.set(b + 1, V);
+        mps.leftLim(b - 1);
+        mps.rightLim(b + 1);
+    }
+
+    return spec;
+}
+
+// Two-site gate on any pair of sites. Distant sites are brought together with a
+// swap network: the upper site is swapped down next to the lower one, the gate
+// is applied, and the site is swapped back up. Returns the gate's spectrum.
+Spectrum applyGate(MPS &mps, ITensor const& gate, int site1, int site2, Args const& args) {
+    int lo = min(site1, site2);
+    int hi = max(site1, site2);
+
+    mps.position(hi);
+    for (int b = hi - 1; b > lo; b--)
+        applyBondGate(mps, b, ITensor(), args, Fromright, true);
+
+    auto spec = applyBondGate(mps, lo, gate, args, Fromleft);
+
+    for (int b = lo + 1; b < hi; b++)
+        applyBondGate(mps, b, ITensor(), args, Fromleft, true);
+
+    return spec;
+}
+
+
+// ========================================================================= //
+// ---------------------------- MPO application ---------------------------- //
+// ========================================================================= //
+
+// Site index of K(i) that x(i) does not share, which K maps x's onto
+Index outputSite(MPO const& K, MPS const& x, int i) {
+    for (auto const& s : inds(K(i)))
+        if (hasTags(s, "Site") && !hasIndex(x(i), s))
+            return s;
+    throw invalid_argument("MPO and MPS do not share a site index");
+}
+
+// Zip-up application: brings x into right-orthogonal form, then sweeps left
+// to right, contracting each MPO tensor into the MPS and splitting off the
+// finished site with an SVD truncated at a tenth of the cutoff and twice the
+// bond cap (no cap when MaxDim is not set), then recompresses the result
+// from the right with the real limits. The orthogonal form keeps the loose
+// truncation errors of the sweep local. Costs about chi^3 d^2 w per site
+// instead of the density-matrix method's chi^3 d^3 w^2. Every SVD goes
+// through splitSVD, so two applications can run on different threads. The
+// result carries the site indices of K that x does not share.
+MPS zipUpApplyMPO(MPO const& K, MPS const& x, Args const& args) {
+    int n = length(x);
+    auto loose = Args("Cutoff=", args.getReal("Cutoff", 1E-16) / 10);
+    if (args.defined("MaxDim"))
+        loose.add("MaxDim", 2 * min(args.getInt("MaxDim"), INT_MAX / 2));
+    auto exact = Args("Cutoff=", 1E-16);
+    vector<Index> out(n + 1);
+    for (int i = 1; i <= n; i++)
+        out[i] = outputSite(K, x, i);
+    MPS res = x;
+    Index link;
+
+    auto carry = x(n);
+    for (int i = n; i > 1; i--) {
+        vector<Index> rows = {siteIndex(x, i)};
+        if (i < n)
+            rows.push_back(link);
+        auto U = splitSVD(carry, rows, exact);
+        link = commonIndex(U, carry);
+        res.set(i, U);
+        carry = x(i - 1) * carry;
+    }
+    res.set(1, carry);
+
+    MPS y = res;
+    carry = y(1) * K(1);
+    for (int i = 1; i < n; i++) {
+        vector<Index> rows = {out[i]};
+        if (i > 1)
+            rows.push_back(link);
+        auto U = splitSVD(carry, rows, loose);
+        link = commonIndex(U, carry);
+        res.set(i, U);
+        carry = carry * (y(i + 1) * K(i + 1));
+    }
+
+    for (int i = n; i > 1; i--) {
+        vector<Index> rows = {out[i]};
+        if (i < n)
+            rows.push_back(link);
+        auto U = splitSVD(carry, rows, args);
+        link = commonIndex(U, carry);
+        res.set(i, U);
+        carry = res(i - 1) * carry;
+    }
+    res.set(1, carry);
+    res.leftLim(0);
+    res.rightLim(2);
+
+    return res;
+}
+
+// Applies K to x with the method given by name: "density" (ITensor's default
+// density-matrix algorithm), "zipup" or "fit" (ITensor's variational fit,
+// starting from x itself, which is the previous layer's result)
+MPS applyMPOBy(string const& method, MPO const& K, MPS const& x, Args const& args) {
+    if (method == "density")
+        return applyMPO(K, x, args);
+    if (method == "zipup")
+        return noPrime(zipUpApplyMPO(K, x, args));
+    if (method == "fit") {
+        auto fit = args;
+        fit.add("Method", "Fit");
+        fit.add("Nsweep", 2);
+        return applyMPO(K, x, x, fit);
+    }
+    throw invalid_argument("Unknown apply method, please use one of the following: 'density', 'zipup', 'fit'");
+}
+
+
+// ========================================================================= //
+// ------------------------------- Layer MPOs ------------------------------ //
+// ========================================================================= //
+
+// Operator that applies first and then second, with indices (s, s')
+static ITensor compose(ITensor const& first, ITensor const& second) {
+    return mapPrime(first * prime(second), 2, 1);
+}
+
+vector<ITensor> randomGates(SiteSet sites) {
+    vector<ITensor> gates;
+    for (int j = 1; j <= length(sites); j++)
+        gates.push_back(makeRAND(sites(j)));
+    return gates;
+}
+
+// Writes the site tensors of a layer directly: gates[j - 1] on every site j (or
+// nothing if gates is empty), followed by CROT(j, j + 1, k) on the bonds first,
+// first + 2, ... (none if first is 0). Each CROT splits as
+// projUp x Id + projDn x (projUp + e^(i pi / 2^k) projDn), so its bond has
+// dimension 2 and every other bond dimension 1. Costs O(n), against O(n) full
+// MPO products when folding single-gate MPOs with nmultMPO.
+MPO layerMPO(SiteSet sites, vector<ITensor> const& gates, int first, int k) {
+    int n = length(sites);
+    auto phase = exp(Cplx_i * Pi / ldexp(1.0, k));
+
+    vector<Index> links(n + 1);
+    vector<bool> paired(n + 1, false);
+    for (int j = 1; j < n; j++) {
+        paired[j] = first > 0 && j >= first && (j - first) % 2 == 0;
+        links[j] = Index(paired[j] ? 2 : 1, format("Link,l=%d", j));
+    }
+
+    auto layer = MPO(sites);
+    for (int j = 1; j <= n; j++) {
+        auto op = gates.empty() ? sites.op("Id", j) : gates[j - 1];
+        ITensor W;
+
+        if (j < n && paired[j]) {
+            W = compose(op, sites.op("projUp", j)) * setElt(links[j] = 1);
+            W += compose(op, sites.op("projDn", j)) * setElt(links[j] = 2);
+        } else if (j > 1 && paired[j - 1]) {
+            auto rot = sites.op("projUp", j) + phase * sites.op("projDn", j);
+            W = op * setElt(links[j - 1] = 1);
+            W += compose(op, rot) * setElt(links[j - 1] = 2);
+        } else {
+            W = op;
+        }
+
+        if (j > 1 && !paired[j - 1])
+            W *= setElt(links[j - 1] = 1);
+        if (j < n && !paired[j])
+            W *= setElt(links[j] = 1);
+
+        layer.set(j, W);
+    }
+
+    return layer;
+}
+
+// The CROT layer of layerMPO on its own, which is the same for every layer of
+// one parity and so is cached
+MPO popCROT_LAYER(SiteSet sites, int first, int k) {
+    return cachedMPO("CROT_LAYER", sites, first, 0, k, [&] {
+        return layerMPO(sites, {}, first, k);
+    });
+}
+
+// One QFT step as a single MPO: H on target, followed by CROT(j, target, j -
+// target) for every j > target. The sites before target carry the identity.
+// On target the H is split by the projector on its output, and the link
+// carries that value to the right, where site j applies
+// projUp + e^(i pi / 2^(j - target)) projDn if it is 1 (projDn) and the
+// identity if it is 0. With aqft_k > 0 only the rotations of angle at least
+// 2 pi / 2^aqft_k are kept, that is up to site target + aqft_k - 1, and the
+// links past it have dimension 1 again.
+MPO popQFT_STEP(SiteSet sites, int target, int aqft_k) {
+    return cachedMPO("QFT_STEP", sites, target, 0, aqft_k, [&] {
+        int n = length(sites);
+        int last = aqft_k > 0 ? min(n, target + aqft_k - 1) : n;
+
+        // Links target to last - 1 carry the output of the H
+        vector<Index> links(n + 1);
+        vector<bool> wide(n + 1, false);
+        for (int j = 1; j < n; j++) {
+            wide[j] = j >= target && j < last;
+            links[j] = Index(wide[j] ? 2 : 1, format("Link,l=%d", j));
+        }
+
+        auto step = MPO(sites);
+        for (int j = 1; j <= n; j++) {
+            ITensor W;
+
+            if (j < target || j > last) {
+                W = sites.op("Id", j);
+            } else if (j == target) {
+                auto H = makeH(sites(j));
+                if (wide[j]) {
+                    W = compose(H, sites.op("projUp", j)) * setElt(links[j] = 1);
+                    W += compose(H, sites.op("projDn", j)) * setElt(links[j] = 2);
+                } else {
+                    W = H;
+                }
+            } else {
+                auto phase = exp(Cplx_i * Pi / ldexp(1.0, j - target));
+                auto rot = sites.op("projUp", j) + phase * sites.op("projDn", j);
+                W = sites.op("Id", j) * setElt(links[j - 1] = 1);
+                rot *= setElt(links[j - 1] = 2);
+                if (wide[j]) {
+                    W *= setElt(links[j] = 1);
+                    rot *= setElt(links[j] = 2);
+                }
+                W += rot;
+            }
+
+            if (j > 1 && !wide[j - 1])
+                W *= setElt(links[j - 1] = 1);
+            if (j < n && !wide[j])
+                W *= setElt(links[j] = 1);
+
+            step.set(j, W);
+        }
+
+        return step;
+    });
 }
 
 
@@ -133,16 +538,18 @@ ITensor initTensor(int len, string form) {
     } else if (form == "|1..1>") {
         vector<int> nz1(len, 2);
         init.set(nz1, 1.0);
-    } else if (form == "|+..+>") {
-        vector<int> nz0(len, 1);
-        init.set(nz0, 1.0);
-        for (int i = 0; i < len; i++)
-            init *= makeH(idx[i]);
-    } else if (form == "|-..->") {
-        vector<int> nz1(len, 2);
-        init.set(nz1, 1.0);
-        for (int i = 0; i < len; i++)
-            init *= makeH(idx[i]);
+    } else if (form == "|+..+>" || form == "|-..->") {
+        // H|0> = (|0> + |1>) / sqrt(2), H|1> = (|0> - |1>) / sqrt(2)
+        double amp = pow(2.0, -len / 2.0);
+        for (long b = 0; b < (1L << len); b++) {
+            vector<int> nz(len);
+            int ones = 0;
+            for (int i = 0; i < len; i++) {
+                nz.at(i) = 1 + ((b >> i) & 1);
+                ones += (b >> i) & 1;
+            }
+            init.set(nz, form == "|-..->" && ones % 2 ? -amp : amp);
+        }
     } else if (form == "|GHZn>") {
         vector<int> nz0(len, 1);
         vector<int> nz1(len, 2);
@@ -159,11 +566,53 @@ ITensor initTensor(int len, string form) {
                                "'|0..0>', '|1..1>', '|+..+>', '|-..->', '|GHZn>', '|Wn>'");
     }
 
-    return noPrime(init);
+    return init;
 }
 
-MPS initMPS(int len, string form) {
-    auto sites = SpinHalf(len, {"ConserveQNs=", false});
+// MPS whose bonds all have dimension dim and whose site tensors have elements
+// site(l, s, r) for link values l, r and site value s. The ends of the chain
+// are closed with the boundary vectors left and right.
+static MPS bondMPS(SiteSet const& sites, int dim, function<Real(int, int, int)> site,
+                   vector<Real> const& left, vector<Real> const& right) {
+    int n = length(sites);
+    vector<Index> links;
+    for (int j = 0; j <= n; j++)
+        links.push_back(Index(dim, format("Link,l=%d", j)));
+
+    auto mps = MPS(sites);
+    for (int j = 1; j <= n; j++) {
+        auto s = sites(j);
+        auto T = ITensor(links[j - 1], s, links[j]);
+        for (int l = 1; l <= dim; l++)
+            for (int v = 1; v <= 2; v++)
+                for (int r = 1; r <= dim; r++)
+                    if (site(l, v, r) != 0)
+                        T.set(links[j - 1] = l, s = v, links[j] = r, site(l, v, r));
+
+        if (j == 1) {
+            auto L = ITensor(links[0]);
+            for (int l = 1; l <= dim; l++)
+                L.set(links[0] = l, left.at(l - 1));
+            T *= L;
+        }
+        if (j == n) {
+            auto R = ITensor(links[n]);
+            for (int r = 1; r <= dim; r++)
+                R.set(links[n] = r, right.at(r - 1));
+            T *= R;
+        }
+
+        mps.set(j, T);
+    }
+
+    return mps;
+}
+
+// Every input state is written straight into its site tensors: product states
+// have bond dimension 1, and GHZ and W states bond dimension 2. The W state
+// link value records whether the single excitation has been placed yet.
+MPS initMPS(SiteSet sites, string form) {
+    int len = length(sites);
     MPS init;
 
     if (form == "|0..0>") {
@@ -171,6 +620,49 @@ MPS initMPS(int len, string form) {
     } else if (form == "|1..1>") {
         init = MPS(InitState(sites, "Dn"));
     } else if (form == "|+..+>") {
+        init = bondMPS(sites, 1, [](int l, int s, int r) { return 1 / sqrt(2); }, {1}, {1});
+    } else if (form == "|-..->") {
+        init = bondMPS(sites, 1, [](int l, int s, int r) { return (s == 1 ? 1 : -1) / sqrt(2); }, {1}, {1});
+    } else if (form == "|GHZn>") {
+        init = bondMPS(sites, 2, [](int l, int s, int r) { return Real(l == s && s == r); },
+                       {1 / sqrt(2), 1 / sqrt(2)}, {1, 1});
+    } else if (form == "|Wn>") {
+        init = bondMPS(sites, 2, [](int l, int s, int r) {
+                           return Real((l == 1 && s == 1 && r == 1) || (l == 1 && s == 2 && r == 2) ||
+                                       (l == 2 && s == 1 && r == 2));
+                       },
+                       {1 / sqrt(len), 0}, {0, 1});
+    } else {
+        throw invalid_argument("Unknown form, please use one of the following: "
+                               "'|0..0>', '|1..1>', '|+..+>', '|-..->', '|GHZn>', '|Wn>'");
+    }
+
+    return init;
+}
+
+MPS initMPS(int len, string form) {
+    return initMPS(SpinHalf(len, {"ConserveQNs=", false}), form);
+}
+
+
+// ========================================================================= //
+// ----------------------------- Other helpers ----------------------------- //
+// ========================================================================= //
+
+ITensor ContractMPS(MPS mps) {
+    auto con = mps(1);
+    for (int i = 2; i <= length(mps); i++)
+        con *= mps(i);
+    
+    return con;
+}
+
+// The original gate-based construction of each input state, kept as a reference
+static MPS gateInitMPS(SiteSet sites, string form) {
+    int len = length(sites);
+    MPS init;
+
+    if (form == "|+..+>") {
         init = MPS(InitState(sites, "Up"));
         for (int i = 1; i <= len; i++)
             init = applyMPO(popH(sites, i), init);
@@ -190,22 +682,31 @@ MPS initMPS(int len, string form) {
         init = applyMPO(toMPO(xplus), init);
         init.normalize();
     } else {
-        throw invalid_argument("Unknown form, please use one of the following: "
-                               "'|0..0>', '|1..1>', '|+..+>', '|-..->', '|GHZn>', '|Wn>'");
+        init = initMPS(sites, form);
     }
 
     return init;
 }
 
+// Checks initMPS against the gate-based construction and against initTensor
+// for every input state on 1 to maxlen qubits
+bool checkInitStates(int maxlen, double precision) {
+    vector<string> forms = {"|0..0>", "|1..1>", "|+..+>", "|-..->", "|GHZn>", "|Wn>"};
+    bool isValid = true;
 
-// ========================================================================= //
-// ----------------------------- Other helpers ----------------------------- //
-// ========================================================================= //
+    for (int len = 1; len <= maxlen; len++) {
+        auto sites = SpinHalf(len, {"ConserveQNs=", false});
+        for (auto form : forms) {
+            auto mps = initMPS(sites, form);
+            auto ref = gateInitMPS(sites, form);
+            isValid &= abs(innerC(ref, mps) - 1.0) < precision;
+            isValid &= abs(norm(mps) - 1.0) < precision;
 
-ITensor ContractMPS(MPS mps) {
-    auto con = mps(1);
-    for (int i = 2; i <= length(mps); i++)
-        con *= mps(i);
-    
-    return con;
+            auto dense = initTensor(len, form);
+            dense.replaceInds(inds(dense), siteInds(mps));
+            isValid &= norm(dense - ContractMPS(mps)) < precision;
+        }
+    }
+
+    return isValid;
 }
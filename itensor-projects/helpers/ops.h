@@ -6,18 +6,56 @@ using namespace itensor;
 // ITensor gates
 ITensor makeH(Index const& s);
 ITensor makeCROT(Index const& s, Index const& t, int k);
+ITensor makeSX(Index const& s);
+ITensor makeSY(Index const& s);
+ITensor makeSW(Index const& s);
+ITensor makeRAND(Index const& s);
+ITensor makeCNOT(Index const& c, Index const& t);
+ITensor makeSWAP(Index const& s, Index const& t);
 ITensor makeQFT_STEP(IndexSet indices, int which);
 
+// Gate cache
+struct GateCacheStats {
+    long hits;
+    long misses;
+};
+
+void setGateCache(bool enabled);
+void clearGateCache();
+GateCacheStats gateCacheStats();
+
 // MPO gates
 MPO popH(SiteSet sites, int target);
+MPO popSX(SiteSet sites, int target);
+MPO popSY(SiteSet sites, int target);
+MPO popSW(SiteSet sites, int target);
 MPO popRAND(SiteSet sites, int target);
 MPO popCNOT(SiteSet sites, int control, int target);
 MPO popSWAP(SiteSet sites, int control, int target);
 MPO popCROT(SiteSet sites, int control, int target, int k);
 
+// Local gate engine
+void applyGate(MPS &mps, ITensor const& gate, int site);
+Spectrum applyGate(MPS &mps, ITensor const& gate, int site1, int site2, Args const& args);
+Spectrum applyBondGate(MPS &mps, int b, ITensor const& gate, Args const& args,
+                       Direction dir = Fromleft, bool swap = false);
+
+// MPO application
+Index outputSite(MPO const& K, MPS const& x, int i);
+MPS zipUpApplyMPO(MPO const& K, MPS const& x, Args const& args);
+MPS applyMPOBy(string const& method, MPO const& K, MPS const& x, Args const& args);
+
+// Layer MPOs
+std::vector<ITensor> randomGates(SiteSet sites);
+MPO layerMPO(SiteSet sites, std::vector<ITensor> const& gates, int first, int k);
+MPO popCROT_LAYER(SiteSet sites, int first, int k);
+MPO popQFT_STEP(SiteSet sites, int target, int aqft_k = 0);
+
 // Init methods
 ITensor initTensor(int len, string form);
+MPS initMPS(SiteSet sites, string type);
 MPS initMPS(int len, string type);
 
 // Other helpers
 ITensor ContractMPS(MPS mps);
+bool checkInitStates(int maxlen, double precision);
@@ -0,0 +1,64 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include "plan.h"
+
+using namespace std;
+
+
+// ========================================================================= //
+// --------------------------------- Sizes --------------------------------- //
+// ========================================================================= //
+
+// Largest dimension bond b of an n-qubit MPS can reach
+double bondDim(int n, int b, double chi) {
+    return min({pow(2.0, b), pow(2.0, n - b), chi});
+}
+
+double mpsBytes(int n, double chi) {
+    double bytes = 0;
+    for (int j = 1; j <= n; j++) {
+        double left = j > 1 ? bondDim(n, j - 1, chi) : 1;
+        double right = j < n ? bondDim(n, j, chi) : 1;
+        bytes += sizeof(Cplx) * 2 * left * right;
+    }
+    return bytes;
+}
+
+// Environments the density method of applyMPO keeps for an MPO of bond
+// dimension w: one per bond, with the MPS and MPO links and their conjugates
+double envBytes(int n, double chi, int w) {
+    double bytes = 0;
+    for (int b = 1; b < n; b++)
+        bytes += sizeof(Cplx) * pow(w * bondDim(n, b, chi), 2);
+    return bytes;
+}
+
+// A two-site tensor with outer bonds chi, and its U, V and SVD workspace
+double svdBytes(double chi) {
+    return 4 * sizeof(Cplx) * pow(2 * chi, 2);
+}
+
+
+// ========================================================================= //
+// ------------------------------ Calibration ------------------------------ //
+// ========================================================================= //
+
+// Milliseconds per untruncated SVD of a random two-site tensor with outer
+// bonds dim, averaged over reps after one untimed run
+double calibrateSVD(int dim, int reps) {
+    auto a = Index(dim), s = Index(2), t = Index(2), b = Index(dim);
+    auto theta = randomITensorC(a, s, t, b);
+
+    ITensor U(a, s), S, V;
+    svd(theta, U, S, V);
+
+    auto tstart = chrono::steady_clock::now();
+    for (int r = 0; r < reps; r++) {
+        U = ITensor(a, s);
+        svd(theta, U, S, V, {"Cutoff=", 0.0});
+    }
+    auto tstop = chrono::steady_clock::now();
+
+    return chrono::duration<double, milli>(tstop - tstart).count() / reps;
+}
@@ -0,0 +1,12 @@
+#include "itensor/all.h"
+#include "itensor/util/print_macro.h"
+
+using namespace itensor;
+
+// Sizes and costs for the --plan mode. Bonds are numbered 1 to n - 1 and
+// capped at chi, and tensors hold complex doubles.
+double bondDim(int n, int b, double chi);
+double mpsBytes(int n, double chi);
+double envBytes(int n, double chi, int w);
+double svdBytes(double chi);
+double calibrateSVD(int dim, int reps);
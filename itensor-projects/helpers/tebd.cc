@@ -0,0 +1,160 @@
+#include <algorithm>
+#include "tebd.h"
+#include "factor.h"
+
+using namespace std;
+
+
+// ========================================================================= //
+// ------------------------------ Thread pool ------------------------------ //
+// ========================================================================= //
+
+ThreadPool::ThreadPool(int threads) {
+    for (int t = 1; t < threads; t++)
+        workers.emplace_back([this] { work(); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> guard(lock);
+        stop = true;
+    }
+    wake.notify_all();
+    for (auto &w : workers)
+        w.join();
+}
+
+void ThreadPool::drain() {
+    for (int k = next++; k < count; k = next++)
+        (*body)(k);
+}
+
+// Returns once every worker has left the round, so the next round can reset
+// the counter safely
+void ThreadPool::run(int count, function<void(int)> const& body) {
+    {
+        lock_guard<mutex> guard(lock);
+        this->body = &body;
+        this->count = count;
+        next = 0;
+        busy = workers.size();
+        round++;
+    }
+    wake.notify_all();
+    drain();
+
+    unique_lock<mutex> guard(lock);
+    done.wait(guard, [this] { return busy == 0; });
+}
+
+void ThreadPool::work() {
+    long seen = 0;
+    while (true) {
+        {
+            unique_lock<mutex> guard(lock);
+            wake.wait(guard, [&] { return stop || round != seen; });
+            if (stop)
+                return;
+            seen = round;
+        }
+        drain();
+
+        lock_guard<mutex> guard(lock);
+        if (--busy == 0)
+            done.notify_one();
+    }
+}
+
+
+// ========================================================================= //
+// ------------------------------ TEBD engine ------------------------------ //
+// ========================================================================= //
+
+// Sweeps right to left with SVDs, leaving B[2..n] right-orthogonal, the norm
+// in B[1] and the singular values of every bond in lambda
+CanonicalMPS toCanonical(MPS mps) {
+    int n = length(mps);
+    CanonicalMPS state;
+    state.sites.resize(n + 1);
+    state.links.resize(n + 1);
+    state.B.resize(n + 1);
+    state.lambda.resize(n + 1);
+    for (int j = 1; j <= n; j++)
+        state.sites[j] = siteIndex(mps, j);
+
+    mps.position(n);
+    auto M = mps(n);
+    for (int j = n; j > 1; j--) {
+        auto U = ITensor(commonIndex(mps(j - 1), M));
+        ITensor S, V;
+        svd(M, U, S, V);
+
+        auto u = commonIndex(U, S);
+        auto v = commonIndex(S, V);
+        state.B[j] = V;
+        state.links[j - 1] = v;
+        state.lambda[j - 1] = S * delta(u, prime(v));
+        M = mps(j - 1) * U * S;
+    }
+    state.B[1] = M;
+
+    return state;
+}
+
+// The truncated B are only approximately orthogonal, so no orthogonality
+// limits are set
+void fromCanonical(CanonicalMPS const& state, MPS &mps) {
+    int n = length(mps);
+    for (int j = 1; j <= n; j++)
+        mps.set(j, state.B[j]);
+    mps.leftLim(0);
+    mps.rightLim(n + 1);
+}
+
+// gates[j - 1] on site j; unitaries keep B right-orthogonal
+void applySiteGates(CanonicalMPS &state, vector<ITensor> const& gates, ThreadPool &pool) {
+    pool.run(gates.size(), [&](int k) {
+        state.B[k + 1] = noPrime(state.B[k + 1] * gates[k]);
+    });
+}
+
+// gates[k] on bond first + 2k. The bonds are disjoint, so each is contracted
+// and factored on its own thread, with the SVD on the raw storage; the new
+// links are made between the two rounds on the calling thread, since ITensor
+// draws the ids of new indices from one unsynchronised generator. Following
+// Hastings, the left tensor is recovered as phi V^dagger rather than by
+// dividing out the singular values, and lambda on the bond to the left only
+// weights the truncation. An update writes only its own two sites and its own
+// bond, and reads the bond to its left, which no other update of the same
+// parity writes.
+void applyBondGates(CanonicalMPS &state, vector<ITensor> const& gates, int first,
+                    Args const& args, ThreadPool &pool) {
+    int n = state.sites.size() - 1;
+    int count = gates.size();
+    vector<ITensor> phi(count);
+    vector<Factor> factors(count);
+    pool.run(count, [&](int k) {
+        int j = first + 2 * k;
+        phi[k] = noPrime(state.B[j] * state.B[j + 1] * gates[k]);
+        auto theta = j > 1 ? state.lambda[j - 1] * prime(phi[k], state.links[j - 1]) : phi[k];
+
+        // Rows on the right, so the vectors kept are those of V
+        vector<Index> right = {state.sites[j + 1]};
+        if (j + 1 < n)
+            right.push_back(state.links[j + 1]);
+        factors[k] = factorSVD(theta, right, args);
+    });
+
+    vector<Index> links(count);
+    for (int k = 0; k < count; k++)
+        links[k] = makeLink(factors[k].S.size());
+
+    pool.run(count, [&](int k) {
+        int j = first + 2 * k;
+        auto V = isometry(factors[k], links[k]);
+        state.B[j] = phi[k] * dag(V);
+        state.B[j + 1] = V;
+        state.links[j] = links[k];
+        state.lambda[j] = diagITensor(factors[k].S, prime(links[k]), links[k]);
+    });
+}
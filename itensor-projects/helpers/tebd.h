@@ -0,0 +1,53 @@
+#include "itensor/all.h"
+#include "itensor/util/print_macro.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace itensor;
+
+// MPS in the right-canonical form used by TEBD: site tensors B, the link
+// index right of every site and the singular values on it as a diagonal
+// tensor with indices (link', link)
+struct CanonicalMPS {
+    std::vector<Index> sites;
+    std::vector<Index> links;
+    std::vector<ITensor> B;
+    std::vector<ITensor> lambda;
+};
+
+// Workers started once and reused by every run(count, body), which calls
+// body(0) to body(count - 1) on the workers and the calling thread, each
+// taking the next index as it finishes the last
+class ThreadPool {
+  public:
+    explicit ThreadPool(int threads);
+    ~ThreadPool();
+    void run(int count, std::function<void(int)> const& body);
+
+  private:
+    void work();
+    void drain();
+
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::function<void(int)> const* body = nullptr;
+    int count = 0;
+    std::atomic<int> next{0};
+    int busy = 0;
+    long round = 0;
+    bool stop = false;
+};
+
+// TEBD engine
+CanonicalMPS toCanonical(MPS mps);
+void fromCanonical(CanonicalMPS const& state, MPS &mps);
+void applySiteGates(CanonicalMPS &state, std::vector<ITensor> const& gates, ThreadPool &pool);
+void applyBondGates(CanonicalMPS &state, std::vector<ITensor> const& gates, int first,
+                    Args const& args, ThreadPool &pool);
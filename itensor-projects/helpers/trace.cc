@@ -0,0 +1,80 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "trace.h"
+
+using namespace std;
+
+
+// ========================================================================= //
+// --------------------------------- Trace --------------------------------- //
+// ========================================================================= //
+
+// One CSV row per traced step: the run it belongs to, the phase and step, the
+// wall time since the previous row, the max and average link dimension, the
+// weight discarded by truncation in that step and the resident and peak
+// memory. Rows go through stdio's buffer, and with no trace open every call
+// returns straight away.
+static FILE *trace_file = nullptr;
+static int trace_run = 0;
+static double trace_norm2 = 1;
+static chrono::steady_clock::time_point trace_last;
+
+void openTrace(string const& path) {
+    trace_file = fopen(path.c_str(), "w");
+    if (!trace_file)
+        throw runtime_error("Cannot open trace file '" + path + "'");
+    fprintf(trace_file, "run,phase,step,ms,max_link,avg_link,discarded,rss_kb,peak_kb\n");
+}
+
+void closeTrace() {
+    if (trace_file)
+        fclose(trace_file);
+    trace_file = nullptr;
+}
+
+// Resident set size from /proc, which getrusage does not report on Linux
+static long residentKB() {
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%*s %ld", &pages) != 1)
+            pages = 0;
+        fclose(statm);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Starts a new run on mps, so the first step is timed from here
+void traceBegin(MPS const& mps) {
+    if (!trace_file)
+        return;
+    trace_run++;
+    trace_norm2 = pow(norm(mps), 2);
+    trace_last = chrono::steady_clock::now();
+}
+
+// The gates are unitary, so all the norm lost since the previous row is
+// weight discarded by truncation. The time spent writing the row is left out
+// of the next one.
+void traceStep(char const* phase, int step, MPS const& mps) {
+    if (!trace_file)
+        return;
+    auto tstop = chrono::steady_clock::now();
+    double tdiff = chrono::duration<double, milli>(tstop - trace_last).count();
+
+    double norm2 = pow(norm(mps), 2);
+    double discarded = trace_norm2 > 0 ? 1 - norm2 / trace_norm2 : 0;
+    trace_norm2 = norm2;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(trace_file, "%d,%s,%d,%.6g,%.6g,%.6g,%.6g,%ld,%ld\n", trace_run, phase, step, tdiff,
+            (double) maxLinkDim(mps), (double) averageLinkDim(mps), discarded, residentKB(),
+            (long) usage.ru_maxrss);
+    trace_last = chrono::steady_clock::now();
+}
@@ -0,0 +1,12 @@
+#include "itensor/all.h"
+#include "itensor/util/print_macro.h"
+
+#include <string>
+
+using namespace itensor;
+
+// Per-step trace
+void openTrace(std::string const& path);
+void closeTrace();
+void traceBegin(MPS const& mps);
+void traceStep(char const* phase, int step, MPS const& mps);
@@ -6,6 +6,10 @@
 #include "itensor/util/print_macro.h"
 #include "../helpers/ops.h"
 #include "../helpers/io.h"
+#include "../helpers/trace.h"
+#include "../helpers/budget.h"
+#include "../../common/harness.h"
+#include "../../common/energy.h"
 
 using namespace itensor;
 using namespace std;
@@ -14,30 +18,51 @@ using namespace std;
 #define INIT_DEFAULT "|0..0>"
 #define CUTOFF_DEFAULT 1E-4
 #define MAXDIM_DEFAULT 1073741824
+#define ENGINE_DEFAULT "mpo"
+#define METHOD_DEFAULT "density"
 
 ITensor applyQFT_tensor(ITensor init);
-MPS applyQFT_mps(MPS mps, double cutoff);
+MPS applyQFT_mps(MPS mps, int maxdim, double cutoff, string const& method, int aqft_k,
+                 TruncationBudget &budget);
+MPS applyQFT_gates(MPS mps, int maxdim, double cutoff, string const& method, int aqft_k,
+                   TruncationBudget &budget);
+MPS applyQFT_local(MPS mps, int maxdim, double cutoff, int aqft_k, TruncationBudget &budget);
+MPS applyQFT(RunArgs const& args, MPS const& mps, int aqft_k, TruncationBudget &budget);
+void precompileQFT(SiteSet sites, string const& engine, int aqft_k);
 
 int main(int argc, char *argv[]) {
-    int qreg_size = QREG_DEFAULT;
-    string init_state = INIT_DEFAULT;
-    double cutoff = CUTOFF_DEFAULT;
-    int maxdim = MAXDIM_DEFAULT;
+    RunArgs args;
+    args.qreg_size = QREG_DEFAULT;
+    args.init_state = INIT_DEFAULT;
+    args.cutoff = CUTOFF_DEFAULT;
+    args.maxdim = MAXDIM_DEFAULT;
+    args.engine = ENGINE_DEFAULT;
+    args.apply_method = METHOD_DEFAULT;
+    args.gate_cache = true;
+    args.budget = 0;
+    args.aqft_k = 0;
+    args.warmup = 0;
+    args.reps = 1;
 
-    set_args(argc, argv, qreg_size, init_state, maxdim, cutoff);
+    set_args(argc, argv, args);
     int verbose = set_verbose();
+    if (!args.trace_path.empty())
+        openTrace(args.trace_path);
+    setGateCache(args.gate_cache);
 
-    // cout << "Number of qubits: " << qreg_size << endl;
-    // cout << "Init state: " << init_state << endl;
-    // cout << "Cutoff: " << cutoff << endl;
+    // cout << "Number of qubits: " << args.qreg_size << endl;
+    // cout << "Init state: " << args.init_state << endl;
+    // cout << "Cutoff: " << args.cutoff << endl;
     // cout << "Verbose: " << verbose << endl;
 
+    Energy energy = create_energy();
+    energy_start(energy);
     srand(2140);
 
 
     // ============ Using standard tensors ============ //
 
-    // auto init_tensor = initTensor(qreg_size, init_state);
+    // auto init_tensor = initTensor(args.qreg_size, args.init_state);
     // auto result_tensor = applyQFT_tensor(init_tensor);
     // PrintData(result_tensor);
 
@@ -45,20 +70,93 @@ int main(int argc, char *argv[]) {
     // ============ Using MPS ============ //
 
 
-    auto init_mps = initMPS(qreg_size, init_state);
+    auto init_mps = initMPS(args.qreg_size, args.init_state);
+    MPS result_mps;
 
-    auto tstart = chrono::steady_clock::now();
+    if (args.engine != "mpo" && args.engine != "gates" && args.engine != "local")
+        throw invalid_argument("Unknown engine, please use one of the following: 'mpo', 'gates', 'local'");
+    if (args.aqft_k < 0)
+        throw invalid_argument("AQFT threshold must be positive, or 0 for the exact QFT");
 
-    auto result_mps = applyQFT_mps(init_mps, cutoff);
+    if (args.engine != "local" && args.gate_cache)
+        precompileQFT(SpinHalf(siteInds(init_mps)), args.engine, args.aqft_k);
+    energy_stop(energy, "init");
 
-    auto tstop = chrono::steady_clock::now();
-    double tdiff = chrono::duration<double, milli>(tstop - tstart).count();
+    // Rotations of angle below 2 pi / 2^aqft_k are dropped, that is those
+    // between qubits more than aqft_k - 1 apart
+    int n = length(init_mps);
+    long rotations = (long) n * (n - 1) / 2;
+    long skipped = 0;
+    for (int i = 1; args.aqft_k > 0 && i <= n; i++)
+        skipped += max(0, n - i - max(args.aqft_k - 1, 0));
+
+    // The budget is spread over the gates of the gates engine, or over the
+    // qubits of the mpo engine, each truncating at every bond, or over the
+    // qubits of the local engine, each sweeping the chain up and back
+    int steps = args.engine == "gates" ? n + rotations - skipped : n;
+    int svds = args.engine == "local" ? 2 * (n - 1) : n - 1;
+    TruncationBudget budget;
+
+    Harness harness("itensor-qft", args.warmup, args.reps, args.json_path);
+    auto reset = [&]() {
+        budget = createBudget(args.budget, steps, svds);
+    };
+    auto run = [&]() {
+        energy_start(energy);
+        result_mps = applyQFT(args, init_mps, args.aqft_k, budget);
+        energy_stop(energy, "circuit", harness);
+    };
+
+    double tdiff = harness_run(harness, reset, run);
     cout << "Full simulation time: " << tdiff << " ms" << endl;
 
     // PrintData(result_mps);
     printfln("Norm: %f", norm(result_mps));
     printfln("Max link dim: %f", maxLinkDim(result_mps));
     printfln("Avg link dim: %f", averageLinkDim(result_mps));
+    if (budget.enabled)
+        printfln("Estimated fidelity: %f (budget %f)", budgetFidelity(budget), args.budget);
+
+    // Fidelity against the exact QFT, run with the same engine and truncation
+    // so that only the dropped rotations differ
+    double fidelity = 1;
+    if (args.aqft_k > 0) {
+        TruncationBudget exact = createBudget(0, 0, 0);
+        energy_start(energy);
+        MPS exact_mps = applyQFT(args, init_mps, 0, exact);
+        energy_stop(energy, "reference");
+        fidelity = std::norm(innerC(exact_mps, result_mps)) /
+            (innerC(exact_mps, exact_mps).real() * innerC(result_mps, result_mps).real());
+        printfln("Skipped rotations: %d of %d", skipped, rotations);
+        printfln("Fidelity vs exact QFT: %f", fidelity);
+    }
+
+    if (verbose) {
+        auto stats = gateCacheStats();
+        printfln("Gate cache: %d hits, %d misses", stats.hits, stats.misses);
+        energy_print(energy, cout);
+    }
+
+    harness_param(harness, "qubits", args.qreg_size);
+    harness_param(harness, "init", args.init_state);
+    harness_param(harness, "engine", args.engine);
+    harness_param(harness, "maxdim", args.maxdim);
+    harness_param(harness, "cutoff", args.cutoff);
+    harness_param(harness, "apply_method", args.apply_method);
+    harness_param(harness, "gate_cache", args.gate_cache);
+    harness_param(harness, "budget", args.budget);
+    harness_param(harness, "aqft_k", args.aqft_k);
+    harness_metric(harness, "max_link_dim", maxLinkDim(result_mps));
+    harness_metric(harness, "avg_link_dim", averageLinkDim(result_mps));
+    if (budget.enabled)
+        harness_metric(harness, "estimated_fidelity", budgetFidelity(budget));
+    if (args.aqft_k > 0) {
+        harness_metric(harness, "skipped_rotations", skipped);
+        harness_metric(harness, "fidelity", fidelity);
+    }
+    energy_metrics(energy, harness);
+    harness_write(harness);
+    closeTrace();
 
     // auto measure_mps = MPS(InitState(spin_sites, "Up"));
     // PrintData(innerC(result_mps, measure_mps));
@@ -75,12 +173,94 @@ ITensor applyQFT_tensor(ITensor init) {
     return init;
 }
 
-MPS applyQFT_mps(MPS mps, double cutoff) {
+MPS applyQFT(RunArgs const& args, MPS const& mps, int aqft_k, TruncationBudget &budget) {
+    if (args.engine == "mpo")
+        return applyQFT_mps(mps, args.maxdim, args.cutoff, args.apply_method, aqft_k, budget);
+    else if (args.engine == "gates")
+        return applyQFT_gates(mps, args.maxdim, args.cutoff, args.apply_method, aqft_k, budget);
+    else
+        return applyQFT_local(mps, args.maxdim, args.cutoff, aqft_k, budget);
+}
+
+// Applies the QFT one qubit at a time, each step (H and all its CROTs) as a
+// single MPO of bond dimension 2
+MPS applyQFT_mps(MPS mps, int maxdim, double cutoff, string const& method, int aqft_k,
+                 TruncationBudget &budget) {
+    SiteSet sites = SpinHalf(siteInds(mps));
+    auto args = Args("MaxDim=", maxdim, "Cutoff=", cutoff);
+    traceBegin(mps);
+    for (int i = 1; i <= length(mps); i++) {
+        auto step = budgetArgs(budget, mps, args);
+        mps = applyMPOBy(method, popQFT_STEP(sites, i, aqft_k), mps, step);
+        budgetStep(budget, mps);
+        traceStep("qubit", i, mps);
+    }
+
+    return mps;
+}
+
+// Applies every H and CROT of the QFT as its own MPO, skipping the CROTs
+// between qubits aqft_k or more apart (if aqft_k is not 0)
+MPS applyQFT_gates(MPS mps, int maxdim, double cutoff, string const& method, int aqft_k,
+                   TruncationBudget &budget) {
     SiteSet sites = SpinHalf(siteInds(mps));
+    auto args = Args("MaxDim=", maxdim, "Cutoff=", cutoff);
+    traceBegin(mps);
     for (int i = 1; i <= length(mps); i++) {
-        mps = applyMPO(popH(sites, i), mps, {"Cutoff=", cutoff});
-        for (int j = i + 1; j <= length(mps); j++)
-            mps = applyMPO(popCROT(sites, j, i, j - i), mps, {"Cutoff=", cutoff});
+        auto gate = budgetArgs(budget, mps, args);
+        mps = applyMPOBy(method, popH(sites, i), mps, gate);
+        budgetStep(budget, mps);
+        traceStep("H", i, mps);
+        int last = aqft_k > 0 ? min(length(mps), i + aqft_k - 1) : length(mps);
+        for (int j = i + 1; j <= last; j++) {
+            gate = budgetArgs(budget, mps, args);
+            mps = applyMPOBy(method, popCROT(sites, j, i, j - i), mps, gate);
+            budgetStep(budget, mps);
+            traceStep("CROT", j, mps);
+        }
+    }
+
+    return mps;
+}
+
+// Builds every MPO of the circuit up front, keeping MPO construction out of
+// the timing
+void precompileQFT(SiteSet sites, string const& engine, int aqft_k) {
+    int n = length(sites);
+    for (int i = 1; i <= n; i++) {
+        if (engine == "mpo") {
+            popQFT_STEP(sites, i, aqft_k);
+            continue;
+        }
+        popH(sites, i);
+        int last = aqft_k > 0 ? min(n, i + aqft_k - 1) : n;
+        for (int j = i + 1; j <= last; j++)
+            popCROT(sites, j, i, j - i);
+    }
+}
+
+// Applies every gate locally instead of sweeping a full-chain MPO. Qubit i is
+// carried up the chain with fused CROT+SWAP bond updates, picking up one
+// controlled rotation per step, and then swapped back into place. With
+// aqft_k > 0 it only travels as far as its last kept rotation.
+MPS applyQFT_local(MPS mps, int maxdim, double cutoff, int aqft_k, TruncationBudget &budget) {
+    auto args = Args("MaxDim=", maxdim, "Cutoff=", cutoff);
+    int n = length(mps);
+
+    traceBegin(mps);
+    for (int i = 1; i <= n; i++) {
+        auto si = siteIndex(mps, i);
+        applyGate(mps, makeH(si), i);
+
+        auto qubit = budgetArgs(budget, mps, args);
+        int last = aqft_k > 0 ? min(n, i + aqft_k - 1) : n;
+        mps.position(i);
+        for (int j = i + 1; j <= last; j++)
+            applyBondGate(mps, j - 1, makeCROT(siteIndex(mps, j), si, j - i), qubit, Fromleft, true);
+        for (int j = last - 1; j >= i; j--)
+            applyBondGate(mps, j, ITensor(), qubit, Fromright, true);
+        budgetStep(budget, mps);
+        traceStep("qubit", i, mps);
     }
 
     return mps;
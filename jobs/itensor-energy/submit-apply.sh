@@ -0,0 +1,25 @@
+#!/bin/bash
+
+# Time per layer and fidelity against exact application of each MPO
+# application method on the random circuit benchmark. The exact reference
+# of the fidelity runs grows as 2^(q/2), so sizes above FIDELITY_MAX_Q are
+# timed without it.
+
+NQUBS=(12 16 20 24 28)
+METHODS=(density zipup fit)
+MAX_DIM=64
+FIDELITY_MAX_Q=20
+
+for q in ${NQUBS[@]}; do
+    FIDELITY=$(( q <= FIDELITY_MAX_Q ))
+    for m in ${METHODS[@]}; do
+        echo "Submitting job for q=${q}, method=${m}..."
+
+        # Wait if too many jobs are running
+        while [ $(squeue -u $USER -h | wc -l) -gt 50 ]; do
+            sleep 1
+        done
+
+        sbatch --nodes=1 --export=PROG=bench,QREG_SIZE=$q,MAX_DIM=$MAX_DIM,DEPTH=$q,METHOD=$m,FIDELITY=$FIDELITY run-itensor-energy.slurm
+    done
+done
@@ -0,0 +1,23 @@
+#!/bin/bash
+
+# Runtime and link dimensions of the QFT with one MPO per qubit (mpo) against
+# one MPO per gate (gates)
+
+NQUBS=(10 20 30 40 50 60 70 80 90)
+ENGINES=(mpo gates)
+INITS=("|0..0>" "|Wn>")
+
+for q in ${NQUBS[@]}; do
+    for e in ${ENGINES[@]}; do
+        for i in ${INITS[@]}; do
+            echo "Submitting job for q=${q}, engine=${e}, init=${i}..."
+
+            # Wait if too many jobs are running
+            while [ $(squeue -u $USER -h | wc -l) -gt 50 ]; do
+                sleep 1
+            done
+
+            sbatch --nodes=1 --export=PROG=qft,QREG_SIZE=$q,INIT=$i,ENGINE=$e run-itensor-energy.slurm
+        done
+    done
+done
@@ -0,0 +1,21 @@
+#!/bin/bash
+
+# Strong scaling of the tebd engine of the random circuit benchmark over the
+# 128 cores of a node
+
+NQUBS=(32 48 64)
+THREADS=(1 2 4 8 16 32 64 128)
+MAX_DIM=256
+
+for q in ${NQUBS[@]}; do
+    for t in ${THREADS[@]}; do
+        echo "Submitting job for q=${q}, threads=${t}..."
+
+        # Wait if too many jobs are running
+        while [ $(squeue -u $USER -h | wc -l) -gt 50 ]; do
+            sleep 1
+        done
+
+        sbatch --nodes=1 --export=PROG=bench,QREG_SIZE=$q,MAX_DIM=$MAX_DIM,DEPTH=$q,ENGINE=tebd,THREADS=$t run-itensor-energy.slurm
+    done
+done
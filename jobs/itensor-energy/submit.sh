@@ -18,6 +18,9 @@ for q in ${NQUBS[@]}; do
     dm=$(($dm/$DFRAC))
     # sbatch --nodes=1 --export=PROG=bench,QREG_SIZE=$q,MAX_DIM=$dm,DEPTH=$(($q+1)) run-itensor-energy.slurm
 
+    # Fidelity budget instead of a max dimension
+    # sbatch --nodes=1 --export=PROG=bench,QREG_SIZE=$q,BUDGET=0.99,DEPTH=$(($q+1)) run-itensor-energy.slurm
+
     # Static max dimension
     # for m in ${MDIMS[@]}; do
     #    sbatch --nodes=1 --export=PROG=bench,QREG_SIZE=$q,MAX_DIM=$m,DEPTH=$(($q+1)) run-itensor-energy.slurm
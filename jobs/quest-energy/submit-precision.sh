@@ -0,0 +1,32 @@
+#!/bin/bash
+
+# Runs every precision build (see quest-projects/build.sh) on the same
+# configurations; precision-report.R compares them against double.
+NQUBS=({32..36})
+NODES=(1 2 4 8 16 32 64 128)
+PRECS=("double" "single" "mixed")
+
+for q in ${NQUBS[@]}; do
+    for p in ${PRECS[@]}; do
+        # Single and mixed states take half the memory of double
+        if [[ $p == "double" && $q -gt 33 ]]; then
+            NODE_IDX_MIN=$(($q-32))
+        elif [[ $p != "double" && $q -gt 34 ]]; then
+            NODE_IDX_MIN=$(($q-33))
+        else
+            NODE_IDX_MIN=0
+        fi
+
+        for n in ${NODES[@]:$NODE_IDX_MIN}; do
+            echo "Submitting job for q=${q}, n=${n}, p=${p}..."
+
+            # Wait if too many jobs are running
+            while [ $(squeue -u $USER -h | wc -l) -gt 50 ]; do
+                sleep 1
+            done
+
+            sbatch --nodes=$n --cpu-freq=high --export=PROG=qft,QREG_SIZE=$q,PRECISION=$p,JSON=out/precision.jsonl run-quest-energy.slurm
+            sbatch --nodes=$n --cpu-freq=high --export=PROG=rand,QREG_SIZE=$q,DEPTH=$(($q+1)),PRECISION=$p,JSON=out/precision.jsonl run-quest-energy.slurm
+        done
+    done
+done
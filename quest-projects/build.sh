@@ -1,9 +1,22 @@
 #!/bin/bash
 
 TARGET=${1}
-BUILD_DIR=../build
+PRECISION=${2:-double}
 SOURCE_DIR=../QuEST
 
+# single and mixed keep the state in float; mixed accumulates norms and
+# validation in double. Each precision builds into its own directory.
+if [ ${PRECISION} == "double" ]; then
+  BUILD_DIR=../build
+  QUEST_PRECISION=2
+elif [ ${PRECISION} == "single" ] || [ ${PRECISION} == "mixed" ]; then
+  BUILD_DIR=../build-${PRECISION}
+  QUEST_PRECISION=1
+else
+  echo "Unknown precision ${PRECISION}, please use one of the following: single, double, mixed" 1>&2
+  exit 1
+fi
+
 mkdir -p ${BUILD_DIR}
 cd ${BUILD_DIR}
 
@@ -17,11 +30,21 @@ PROFILING=0
 CC=cc
 CXX=CC
 
+# Lets the programs use MPI directly for batched qubit exchanges
+if [ ${DISTRIBUTED} == 1 ]; then
+  USER_FLAGS="-DDISTRIBUTED_BUILD"
+fi
+if [ ${PRECISION} == "mixed" ]; then
+  USER_FLAGS="${USER_FLAGS} -DMIXED_PRECISION"
+fi
+
 cmake ../${SOURCE_DIR} \
   -DCMAKE_C_COMPILER=${CC} \
   -DCMAKE_CXX_COMPILER=${CXX} \
+  -DCMAKE_CXX_FLAGS="${USER_FLAGS}" \
   -DUSER_SOURCE=${USER_SOURCE} \
   -DOUTPUT_EXE=${OUTPUT_EXE} \
+  -DPRECISION=${QUEST_PRECISION} \
   -DDISTRIBUTED=${DISTRIBUTED} \
   -DMULTITHREADED=${MULTITHREADED} \
   -DGPUACCELERATED=${GPUACCELERATED} \
@@ -0,0 +1,154 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "QuEST.h"
+#include "gates.h"
+
+// Checkpoint layout: a fixed-size header (magic, qubit count, bytes per real,
+// layer, qubit map), then the real parts of all amplitudes in chunk order,
+// then the imaginary parts. Each rank reads and writes its own chunk at its
+// own offset straight from the state vector, so nothing is staged in memory.
+#define CHECKPOINT_MAGIC 0x54504b4354534551 // "QESTCKPT" as little-endian bytes
+#define CHECKPOINT_HEADER 4096
+#define CHECKPOINT_PIECE (1LL << 26)
+
+struct CheckpointStats {
+  int writes;
+  double bytes;
+  double ms;
+};
+
+
+// ========================================================================= //
+// -------------------------------- Header --------------------------------- //
+// ========================================================================= //
+
+inline std::vector<char> checkpoint_header(Qureg qureg, QubitMap const& map, int layer) {
+  std::vector<char> header(CHECKPOINT_HEADER, 0);
+  int64_t* fields = (int64_t*) header.data();
+  fields[0] = CHECKPOINT_MAGIC;
+  fields[1] = qureg.numQubitsRepresented;
+  fields[2] = sizeof(qreal);
+  fields[3] = layer;
+  for (size_t q = 0; q < map.physical.size(); q++)
+    fields[4 + q] = map.physical[q];
+  return header;
+}
+
+// Checks a header against qureg and returns its layer, filling in map
+inline int parse_header(std::vector<char> const& header, Qureg qureg, QubitMap& map) {
+  int64_t const* fields = (int64_t const*) header.data();
+  if (fields[0] != (int64_t) CHECKPOINT_MAGIC)
+    throw std::runtime_error("Not a QuEST checkpoint");
+  if (fields[1] != qureg.numQubitsRepresented || fields[2] != (int64_t) sizeof(qreal))
+    throw std::runtime_error("Checkpoint does not match the number of qubits or the precision");
+
+  for (size_t q = 0; q < map.physical.size(); q++)
+    map.physical[q] = fields[4 + q];
+  return fields[3];
+}
+
+
+// ========================================================================= //
+// --------------------------------- I/O ----------------------------------- //
+// ========================================================================= //
+
+// Byte offset of element e of this rank's chunk of the real (part 0) or
+// imaginary (part 1) amplitudes
+inline long long checkpoint_offset(Qureg qureg, int part, long long e) {
+  long long index = part * qureg.numAmpsTotal + qureg.chunkId * qureg.numAmpsPerChunk + e;
+  return CHECKPOINT_HEADER + index * (long long) sizeof(qreal);
+}
+
+// Writes the state after layer layers to path, through path.tmp so a job
+// killed mid-write leaves the previous checkpoint intact
+inline void write_checkpoint(Qureg qureg, QubitMap const& map, int layer, std::string const& path,
+                             CheckpointStats& stats) {
+  auto tstart = std::chrono::steady_clock::now();
+  std::string tmp = path + ".tmp";
+  std::vector<char> header = checkpoint_header(qureg, map, layer);
+  qreal* parts[2] = {qureg.stateVec.real, qureg.stateVec.imag};
+  long long chunk = qureg.numAmpsPerChunk;
+
+#ifdef DISTRIBUTED_BUILD
+  MPI_File file;
+  if (MPI_File_open(MPI_COMM_WORLD, tmp.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                    MPI_INFO_NULL, &file) != MPI_SUCCESS)
+    throw std::runtime_error("Cannot open checkpoint file '" + tmp + "'");
+  if (qureg.chunkId == 0)
+    MPI_File_write_at(file, 0, header.data(), CHECKPOINT_HEADER, MPI_BYTE, MPI_STATUS_IGNORE);
+
+  // Chunks are equal on all ranks, so every rank makes the same calls
+  for (int part = 0; part < 2; part++)
+    for (long long e = 0; e < chunk; e += CHECKPOINT_PIECE) {
+      long long count = std::min(CHECKPOINT_PIECE, chunk - e);
+      MPI_File_write_at_all(file, checkpoint_offset(qureg, part, e), parts[part] + e,
+                            count * sizeof(qreal), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+  MPI_File_close(&file);
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  if (qureg.chunkId == 0 && rename(tmp.c_str(), path.c_str()) != 0)
+    throw std::runtime_error("Cannot replace checkpoint file '" + path + "'");
+  MPI_Barrier(MPI_COMM_WORLD);
+#else
+  FILE* file = fopen(tmp.c_str(), "wb");
+  if (!file)
+    throw std::runtime_error("Cannot open checkpoint file '" + tmp + "'");
+  fwrite(header.data(), 1, CHECKPOINT_HEADER, file);
+  for (int part = 0; part < 2; part++)
+    fwrite(parts[part], sizeof(qreal), chunk, file);
+  if (fclose(file) != 0 || rename(tmp.c_str(), path.c_str()) != 0)
+    throw std::runtime_error("Cannot write checkpoint file '" + path + "'");
+#endif
+
+  auto tstop = std::chrono::steady_clock::now();
+  stats.ms += std::chrono::duration<double, std::milli>(tstop - tstart).count();
+  stats.bytes += CHECKPOINT_HEADER + 2.0 * qureg.numAmpsTotal * sizeof(qreal);
+  stats.writes++;
+}
+
+// Loads a checkpoint written by write_checkpoint into qureg and map and
+// returns the number of layers it had applied
+inline int read_checkpoint(Qureg qureg, QubitMap& map, std::string const& path) {
+  std::vector<char> header(CHECKPOINT_HEADER);
+  qreal* parts[2] = {qureg.stateVec.real, qureg.stateVec.imag};
+  long long chunk = qureg.numAmpsPerChunk;
+
+#ifdef DISTRIBUTED_BUILD
+  MPI_File file;
+  if (MPI_File_open(MPI_COMM_WORLD, path.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS)
+    throw std::runtime_error("Cannot open checkpoint file '" + path + "'");
+  MPI_File_read_at_all(file, 0, header.data(), CHECKPOINT_HEADER, MPI_BYTE, MPI_STATUS_IGNORE);
+  int layer = parse_header(header, qureg, map);
+
+  for (int part = 0; part < 2; part++)
+    for (long long e = 0; e < chunk; e += CHECKPOINT_PIECE) {
+      long long count = std::min(CHECKPOINT_PIECE, chunk - e);
+      MPI_File_read_at_all(file, checkpoint_offset(qureg, part, e), parts[part] + e,
+                           count * sizeof(qreal), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+  MPI_File_close(&file);
+#else
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file || fread(header.data(), 1, CHECKPOINT_HEADER, file) != CHECKPOINT_HEADER)
+    throw std::runtime_error("Cannot read checkpoint file '" + path + "'");
+  int layer = parse_header(header, qureg, map);
+
+  for (int part = 0; part < 2; part++)
+    if (fread(parts[part], sizeof(qreal), chunk, file) != (size_t) chunk)
+      throw std::runtime_error("Checkpoint file '" + path + "' is truncated");
+  fclose(file);
+#endif
+
+  return layer;
+}
+
+#endif
@@ -0,0 +1,244 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "QuEST.h"
+#include "gates.h"
+#include "../common/circuit.h"
+#include "../common/harness.h"
+#include "../common/energy.h"
+
+#define CIRCUIT_DEFAULT "rand"
+#define QREG_DEFAULT 24
+#define DEPTH_DEFAULT 16
+#define MODE_DEFAULT "gates"
+#define FUSE_DEFAULT 3
+#define FUSE_MAX 5
+#define SAMPLE_AMPS 16
+#define CACHE_DEFAULT 14
+
+using namespace std;
+
+vector<Gate> circuit_gates(Circuit const& circuit);
+
+void set_args(int argc, char *argv[], string &name, int &qreg_size, int &depth, string &mode,
+              int &fuse_qubits, int &cache_qubits, Harness &harness);
+int set_verbose();
+
+
+int main(int argc, char *argv[]) {
+  // Set circuit, number of qubits and verbosity
+  string name = CIRCUIT_DEFAULT;
+  int qreg_size = QREG_DEFAULT;
+  int depth = DEPTH_DEFAULT;
+  string mode = MODE_DEFAULT;
+  int fuse_qubits = FUSE_DEFAULT;
+  int cache_qubits = CACHE_DEFAULT;
+  Harness harness("quest-circuit");
+
+  set_args(argc, argv, name, qreg_size, depth, mode, fuse_qubits, cache_qubits, harness);
+  if (mode != "gates" && mode != "fused" && mode != "scheduled")
+    throw invalid_argument("Unknown mode, please use one of the following: 'gates', 'fused', 'scheduled'");
+  if (fuse_qubits < 1 || fuse_qubits > FUSE_MAX)
+    throw invalid_argument("Fused blocks must have between 1 and " + to_string(FUSE_MAX) + " qubits");
+  int verbose = set_verbose();
+
+  // Build the circuit and everything the mode needs before any timing
+  Circuit circuit = load_circuit(name, qreg_size, depth);
+  qreg_size = circuit.qubits;
+  vector<Gate> gates = circuit_gates(circuit);
+
+  // Prepare the hardware-agnostic QuEST environment
+  QuESTEnv env = createQuESTEnv();
+
+  if (env.rank == 0 && verbose) {
+    cout << "Verbose is ON" << endl;
+    cout << "No. processes: " << env.numRanks << endl;
+    cout << "Circuit: " << name << endl;
+    cout << "No. qubits: " << qreg_size << endl;
+    cout << "Mode: " << mode << endl;
+  }
+
+  Energy energy = create_energy();
+  energy_start(energy);
+  Qureg qureg = createQureg(qreg_size, env);
+  QubitMap layout(qreg_size);
+  ScheduleStats stats = {0, 0, 0, 0};
+
+  vector<ComplexMatrixN> matrices;
+  vector<Gate> blocks;
+  vector<Step> steps;
+  if (mode == "gates") {
+    for (auto const& gate : gates) {
+      int dim = 1 << gate.qubits.size();
+      ComplexMatrixN u = createComplexMatrixN(gate.qubits.size());
+      for (int r = 0; r < dim; r++)
+        for (int c = 0; c < dim; c++) {
+          u.real[r][c] = gate.matrix[r * dim + c].real();
+          u.imag[r][c] = gate.matrix[r * dim + c].imag();
+        }
+      matrices.push_back(u);
+    }
+  } else {
+    blocks = fuse_gates(gates, fuse_qubits, cache_qubits);
+  }
+  if (mode == "scheduled") {
+    // Each repetition replays the plan, which leaves the state in layout
+    int local = local_qubits(qureg);
+    naive_schedule(gates, local, stats, qureg.numAmpsPerChunk);
+    steps = schedule_gates(blocks, layout, local, stats, qureg.numAmpsPerChunk);
+  }
+  syncQuESTEnv(env);
+  energy_stop(energy, "init");
+
+  long passes = 0;
+  auto reset = [&]() {
+    initZeroState(qureg);
+    passes = 0;
+    syncQuESTEnv(env);
+  };
+  auto run = [&]() {
+    energy_start(energy);
+    if (mode == "fused") {
+      passes = apply_gates(qureg, blocks, cache_qubits);
+    } else if (mode == "scheduled") {
+      passes = run_schedule(qureg, steps, cache_qubits);
+    } else {
+      for (size_t g = 0; g < gates.size(); g++) {
+        vector<int> targets(gates[g].qubits);
+        multiQubitUnitary(qureg, targets.data(), targets.size(), matrices[g]);
+      }
+    }
+    syncQuESTEnv(env);
+    energy_stop(energy, "circuit", harness);
+  };
+
+  double tdiff = harness_run(harness, reset, run);
+
+  // Collective reads, for comparing builds of different precision
+  double norm = total_prob(qureg);
+  vector<double> amps = sample_amps(qureg, layout, SAMPLE_AMPS);
+
+  Complex amp = get_amp(qureg, layout, 0);
+
+  if (env.rank == 0) {
+    if (verbose)
+      cout << "Time taken: " << tdiff << " ms" << endl;
+    else
+      cout << tdiff << endl;
+    if (verbose)
+      cout << "Norm: " << norm << " (" << PRECISION_NAME << " precision)" << endl;
+
+    if (verbose) {
+      cout << "Gates: " << gates.size() << endl;
+      cout << "Amplitude of |0..0>: " << amp.real << " + " << amp.imag << "i" << endl;
+    }
+    if (verbose && mode != "gates") {
+      cout << "Fused blocks: " << blocks.size() << endl;
+      cout << "Passes: " << passes << endl;
+    }
+    if (verbose && mode == "scheduled") {
+      cout << "Exchanges: " << stats.exchanges << " (naive: " << stats.naive_exchanges << ")" << endl;
+      cout << "Bytes sent per rank: " << stats.bytes << " (naive: " << stats.naive_bytes << ")" << endl;
+    }
+  }
+
+#ifdef DISTRIBUTED_BUILD
+  energy_reduce(energy);
+#endif
+  if (env.rank == 0 && verbose)
+    energy_print(energy, cout);
+
+  harness.rank = env.rank;
+  harness_param(harness, "circuit", name);
+  harness_param(harness, "qubits", qreg_size);
+  harness_param(harness, "gates", (long) gates.size());
+  harness_param(harness, "mode", mode);
+  harness_param(harness, "fuse_qubits", fuse_qubits);
+  harness_param(harness, "cache_qubits", cache_qubits);
+  harness_param(harness, "ranks", env.numRanks);
+  harness_param(harness, "threads", harness_threads());
+  harness_param(harness, "precision", (int) sizeof(qreal));
+  harness_param(harness, "precision_mode", PRECISION_NAME);
+  harness_metric(harness, "norm", norm);
+  harness_metric(harness, "amps", amps);
+  harness_metric(harness, "amp0_re", (double) amp.real);
+  harness_metric(harness, "amp0_im", (double) amp.imag);
+  if (mode != "gates") {
+    harness_metric(harness, "blocks", (long) blocks.size());
+    harness_metric(harness, "passes", passes);
+  }
+  if (mode == "scheduled") {
+    harness_metric(harness, "exchanges", stats.exchanges);
+    harness_metric(harness, "bytes_sent", stats.bytes);
+  }
+  energy_metrics(energy, harness);
+  harness_write(harness);
+
+  // Free memory
+  for (auto& u : matrices)
+    destroyComplexMatrixN(u);
+  destroyQureg(qureg, env);
+  destroyQuESTEnv(env);
+
+  return 0;
+}
+
+
+// The IR already uses QuEST's matrix layout
+vector<Gate> circuit_gates(Circuit const& circuit) {
+  vector<Gate> gates;
+  for (auto const& op : circuit.ops) {
+    Gate gate;
+    gate.qubits = op.qubits;
+    for (auto const& z : op.matrix)
+      gate.matrix.push_back(complex<qreal>(z.real(), z.imag()));
+    gates.push_back(gate);
+  }
+
+  return gates;
+}
+
+void set_args(int argc, char* argv[], string& name, int& qreg_size, int& depth, string& mode,
+              int& fuse_qubits, int& cache_qubits, Harness& harness) {
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "-c") {
+      name = argv[++i];
+    } else if (arg == "-q") {
+      qreg_size = atoi(argv[++i]);
+    } else if (arg == "-d") {
+      depth = atoi(argv[++i]);
+    } else if (arg == "-m") {
+      mode = argv[++i];
+    } else if (arg == "-k") {
+      fuse_qubits = atoi(argv[++i]);
+    } else if (arg == "-b") {
+      cache_qubits = atoi(argv[++i]);
+    } else if (arg == "-w") {
+      harness.warmup = atoi(argv[++i]);
+    } else if (arg == "-n") {
+      harness.reps = atoi(argv[++i]);
+    } else if (arg == "-j") {
+      harness.json_path = argv[++i];
+    } else {
+      string message = "Error: Unknown argument '" + arg +
+        "'! Use: ./bin -c qft|rand|$QASM_FILE [-q $NQUBITS -d $DEPTH] -m $MODE [-w $WARMUP -n $REPS -j $JSON]";
+      throw invalid_argument(message);
+    }
+  }
+
+  if (harness.warmup < 0 || harness.reps < 1)
+    throw invalid_argument("Error: -w must be at least 0 and -n at least 1");
+}
+
+int set_verbose() {
+  const char* tmp = getenv("VERBOSE");
+  string verbose_str(tmp ? tmp : "");
+  if (verbose_str == "1")
+    return 1;
+  else
+    return 0;
+}
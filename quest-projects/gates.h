@@ -0,0 +1,752 @@
+#ifndef GATES_H
+#define GATES_H
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "QuEST.h"
+#include "../common/plan.h"
+
+#ifdef DISTRIBUTED_BUILD
+#include <mpi.h>
+#endif
+
+// Precision of norms and validation sums. Mixed-precision builds (QuEST with
+// PRECISION=1 and -DMIXED_PRECISION, see build.sh) keep the state in float
+// and accumulate in double; the other builds accumulate in qreal.
+#ifdef MIXED_PRECISION
+typedef double acc_real;
+#define PRECISION_NAME "mixed"
+#else
+typedef qreal acc_real;
+#define PRECISION_NAME (sizeof(qreal) == 4 ? "single" : sizeof(qreal) == 8 ? "double" : "quad")
+#endif
+
+// Gate on an ascending list of qubits, stored as a dense 2^k x 2^k row-major
+// matrix where bit j of a row/column index is the state of qubits[j] (the
+// same convention as QuEST's multiQubitUnitary)
+struct Gate {
+  std::vector<int> qubits;
+  std::vector<std::complex<qreal>> matrix;
+};
+
+// Logical-to-physical qubit map. Swaps of logical qubits become relabellings
+// when lazy is set, and amplitude indices are translated on read, so a swap
+// costs nothing until the permutation is materialised.
+struct QubitMap {
+  std::vector<int> physical;
+  bool lazy;
+
+  QubitMap(int nqubits, bool lazy = true) : physical(nqubits), lazy(lazy) {
+    for (int q = 0; q < nqubits; q++)
+      physical[q] = q;
+  }
+};
+
+// One step of a distributed schedule: either a batched exchange of the listed
+// (global, local) physical qubit pairs, or a gate on physical qubits
+struct Step {
+  std::vector<std::pair<int, int>> swaps;
+  Gate gate;
+};
+
+// Exchanges and bytes sent per rank by a schedule, and by the naive schedule
+// in which every non-diagonal gate on a global qubit exchanges the whole chunk
+struct ScheduleStats {
+  long exchanges;
+  long long bytes;
+  long naive_exchanges;
+  long long naive_bytes;
+};
+
+// Passes over the state vector of running a gate list, how many of them are
+// diagonal, and the exchanges and bytes sent per rank, without running it
+struct PassPlan {
+  long passes;
+  long diagonal;
+  long exchanges;
+  long long bytes;
+};
+
+// Milliseconds per byte of chunk of a dense and of a diagonal pass
+struct PassRates {
+  double dense;
+  double diagonal;
+};
+
+
+// ========================================================================= //
+// ------------------------------- Qubit map ------------------------------- //
+// ========================================================================= //
+
+inline void swap_qubits(Qureg qureg, QubitMap& map, int qubit1, int qubit2) {
+  if (map.lazy)
+    std::swap(map.physical[qubit1], map.physical[qubit2]);
+  else
+    swapGate(qureg, map.physical[qubit1], map.physical[qubit2]);
+}
+
+// Translates a logical basis-state index into the index it is stored at
+inline long long physical_index(QubitMap const& map, long long index) {
+  long long physical = 0;
+  for (size_t q = 0; q < map.physical.size(); q++)
+    if (index >> q & 1)
+      physical |= 1LL << map.physical[q];
+  return physical;
+}
+
+inline Complex get_amp(Qureg qureg, QubitMap const& map, long long index) {
+  return getAmp(qureg, physical_index(map, index));
+}
+
+// Applies the pending permutation with at most n - 1 swap gates, after which
+// the map is the identity
+inline void materialise(Qureg qureg, QubitMap& map) {
+  int n = map.physical.size();
+  for (int q = 0; q < n; q++) {
+    if (map.physical[q] == q)
+      continue;
+    int other = std::find(map.physical.begin(), map.physical.end(), q) - map.physical.begin();
+    swapGate(qureg, map.physical[q], q);
+    map.physical[other] = map.physical[q];
+    map.physical[q] = q;
+  }
+}
+
+
+// ========================================================================= //
+// --------------------------------- Gates --------------------------------- //
+// ========================================================================= //
+
+// Same matrix as rotateAroundAxis: exp(-i angle/2 * axis . sigma)
+inline Gate rotation_gate(int qubit, qreal angle, Vector axis) {
+  qreal norm = sqrt(axis.x * axis.x + axis.y * axis.y + axis.z * axis.z);
+  qreal x = axis.x / norm, y = axis.y / norm, z = axis.z / norm;
+  qreal c = cos(angle / 2), s = sin(angle / 2);
+
+  Gate gate;
+  gate.qubits = {qubit};
+  gate.matrix = {{c, -s * z}, {-s * y, -s * x},
+                 {s * y, -s * x}, {c, s * z}};
+  return gate;
+}
+
+inline Gate hadamard_gate(int qubit) {
+  qreal h = 1 / sqrt(2.0);
+  Gate gate;
+  gate.qubits = {qubit};
+  gate.matrix = {h, h, h, -h};
+  return gate;
+}
+
+// Same matrix as controlledPhaseShift
+inline Gate phase_gate(int qubit1, int qubit2, qreal angle) {
+  Gate gate;
+  gate.qubits = {std::min(qubit1, qubit2), std::max(qubit1, qubit2)};
+  gate.matrix.assign(16, 0);
+  for (int i = 0; i < 3; i++)
+    gate.matrix[5 * i] = 1;
+  gate.matrix[15] = std::polar((qreal) 1, angle);
+  return gate;
+}
+
+// Embeds gate into the larger ascending qubit list qubits
+inline Gate expand_gate(Gate const& gate, std::vector<int> const& qubits) {
+  int k = gate.qubits.size();
+  int dim = 1 << qubits.size();
+  std::vector<int> pos;
+  for (int q : gate.qubits)
+    pos.push_back(std::find(qubits.begin(), qubits.end(), q) - qubits.begin());
+
+  int mask = 0;
+  for (int p : pos)
+    mask |= 1 << p;
+
+  auto sub = [&](int index) {
+    int s = 0;
+    for (int j = 0; j < k; j++)
+      s |= (index >> pos[j] & 1) << j;
+    return s;
+  };
+
+  Gate big;
+  big.qubits = qubits;
+  big.matrix.assign(dim * dim, 0);
+  for (int r = 0; r < dim; r++)
+    for (int c = 0; c < dim; c++)
+      if ((r & ~mask) == (c & ~mask))
+        big.matrix[r * dim + c] = gate.matrix[sub(r) * (1 << k) + sub(c)];
+  return big;
+}
+
+inline bool is_diagonal(Gate const& gate) {
+  int dim = 1 << gate.qubits.size();
+  for (int r = 0; r < dim; r++)
+    for (int c = 0; c < dim; c++)
+      if (r != c && gate.matrix[r * dim + c] != std::complex<qreal>(0))
+        return false;
+  return true;
+}
+
+// Moves gate onto the physical qubits given by map, in ascending order
+inline Gate relabel_gate(Gate const& gate, QubitMap const& map) {
+  Gate mapped = gate;
+  for (int& q : mapped.qubits)
+    q = map.physical[q];
+  std::vector<int> qubits(mapped.qubits);
+  std::sort(qubits.begin(), qubits.end());
+  return expand_gate(mapped, qubits);
+}
+
+// Fuses later after earlier into one gate on the union of their qubits
+inline Gate fuse_pair(Gate const& earlier, Gate const& later) {
+  std::vector<int> qubits;
+  std::set_union(earlier.qubits.begin(), earlier.qubits.end(),
+                 later.qubits.begin(), later.qubits.end(), back_inserter(qubits));
+  Gate a = expand_gate(later, qubits);
+  Gate b = expand_gate(earlier, qubits);
+  int dim = 1 << qubits.size();
+
+  Gate fused;
+  fused.qubits = qubits;
+  fused.matrix.assign(dim * dim, 0);
+  for (int r = 0; r < dim; r++)
+    for (int m = 0; m < dim; m++)
+      for (int c = 0; c < dim; c++)
+        fused.matrix[r * dim + c] += a.matrix[r * dim + m] * b.matrix[m * dim + c];
+  return fused;
+}
+
+
+// ========================================================================= //
+// -------------------------------- Fusion --------------------------------- //
+// ========================================================================= //
+
+// Greedily fuses a gate list into blocks of at most max_qubits qubits. A gate
+// may join any block at or after the last block that touches one of its
+// qubits, since it commutes with every block after that. It only joins blocks
+// it overlaps, or blocks on the same side of the cache boundary (qubits below
+// cache_qubits), so low blocks stay eligible for cache-blocked execution.
+inline std::vector<Gate> fuse_gates(std::vector<Gate> const& gates, int max_qubits,
+                                    int cache_qubits) {
+  std::vector<Gate> blocks;
+  std::vector<int> last;
+
+  for (auto const& gate : gates) {
+    int from = 0;
+    for (int q : gate.qubits) {
+      if (q >= (int) last.size())
+        last.resize(q + 1, -1);
+      from = std::max(from, last[q]);
+    }
+
+    bool low = gate.qubits.back() < cache_qubits;
+    int target = -1;
+    for (int b = from; b < (int) blocks.size() && target < 0; b++) {
+      auto const& qubits = blocks[b].qubits;
+      std::vector<int> both;
+      std::set_union(qubits.begin(), qubits.end(), gate.qubits.begin(), gate.qubits.end(),
+                     back_inserter(both));
+      bool overlap = both.size() < qubits.size() + gate.qubits.size();
+      bool same_side = (qubits.back() < cache_qubits) == low;
+      if ((int) both.size() <= max_qubits && (overlap || same_side))
+        target = b;
+    }
+
+    if (target < 0) {
+      blocks.push_back(gate);
+      target = blocks.size() - 1;
+    } else {
+      blocks[target] = fuse_pair(blocks[target], gate);
+    }
+
+    for (int q : gate.qubits)
+      last[q] = target;
+  }
+
+  return blocks;
+}
+
+
+// ========================================================================= //
+// -------------------------------- Kernels -------------------------------- //
+// ========================================================================= //
+
+// Applies a K-qubit gate to the size contiguous amplitudes at re/im. All of
+// its qubits must index within the array, i.e. be below log2(size). K is a
+// template parameter so the small matrix-vector product is fully unrolled.
+template <int K>
+inline void apply_block(qreal* re, qreal* im, long long size, Gate const& gate) {
+  const int dim = 1 << K;
+  long long offsets[dim];
+  qreal mre[dim * dim], mim[dim * dim];
+  for (int m = 0; m < dim; m++) {
+    offsets[m] = 0;
+    for (int j = 0; j < K; j++)
+      if (m >> j & 1)
+        offsets[m] |= 1LL << gate.qubits[j];
+  }
+  for (int i = 0; i < dim * dim; i++) {
+    mre[i] = gate.matrix[i].real();
+    mim[i] = gate.matrix[i].imag();
+  }
+
+  // Indices below the lowest gate qubit form contiguous runs that all see the
+  // same matrix, so the inner loop over a run vectorises
+  long long run = 1LL << gate.qubits[0];
+  for (long long n = 0; n < size >> K; n += run) {
+    // Spread the bits of n around the gate qubits
+    long long base = n;
+    for (int j = 0; j < K; j++) {
+      long long low = base & ((1LL << gate.qubits[j]) - 1);
+      base = ((base ^ low) << 1) | low;
+    }
+
+    qreal* __restrict__ r0 = re + base;
+    qreal* __restrict__ i0 = im + base;
+#   pragma omp simd
+    for (long long l = 0; l < run; l++) {
+      qreal vre[dim], vim[dim];
+      for (int m = 0; m < dim; m++) {
+        vre[m] = r0[offsets[m] + l];
+        vim[m] = i0[offsets[m] + l];
+      }
+      for (int r = 0; r < dim; r++) {
+        qreal sre = 0, sim = 0;
+        for (int c = 0; c < dim; c++) {
+          sre += mre[r * dim + c] * vre[c] - mim[r * dim + c] * vim[c];
+          sim += mre[r * dim + c] * vim[c] + mim[r * dim + c] * vre[c];
+        }
+        r0[offsets[r] + l] = sre;
+        i0[offsets[r] + l] = sim;
+      }
+    }
+  }
+}
+
+inline void apply_block(qreal* re, qreal* im, long long size, Gate const& gate) {
+  switch (gate.qubits.size()) {
+    case 1: apply_block<1>(re, im, size, gate); break;
+    case 2: apply_block<2>(re, im, size, gate); break;
+    case 3: apply_block<3>(re, im, size, gate); break;
+    case 4: apply_block<4>(re, im, size, gate); break;
+    case 5: apply_block<5>(re, im, size, gate); break;
+    default: throw std::invalid_argument("Fused blocks are limited to 5 qubits");
+  }
+}
+
+// Applies a gate through QuEST, which handles qubits outside the local chunk
+inline void apply_quest(Qureg qureg, Gate const& gate) {
+  int k = gate.qubits.size();
+  int dim = 1 << k;
+  ComplexMatrixN u = createComplexMatrixN(k);
+  for (int r = 0; r < dim; r++)
+    for (int c = 0; c < dim; c++) {
+      u.real[r][c] = gate.matrix[r * dim + c].real();
+      u.imag[r][c] = gate.matrix[r * dim + c].imag();
+    }
+
+  std::vector<int> targets(gate.qubits);
+  multiQubitUnitary(qureg, targets.data(), k, u);
+  destroyComplexMatrixN(u);
+}
+
+// Multiplies the local chunk by a diagonal gate on any qubits, local or not,
+// which never needs communication
+inline void apply_diagonal(Qureg qureg, Gate const& gate) {
+  int k = gate.qubits.size();
+  int dim = 1 << k;
+  long long chunk = qureg.numAmpsPerChunk;
+  long long offset = qureg.chunkId * chunk;
+  qreal* re = qureg.stateVec.real;
+  qreal* im = qureg.stateVec.imag;
+
+# pragma omp parallel for schedule(static)
+  for (long long l = 0; l < chunk; l++) {
+    int m = 0;
+    for (int j = 0; j < k; j++)
+      m |= ((offset + l) >> gate.qubits[j] & 1) << j;
+    std::complex<qreal> d = gate.matrix[m * dim + m];
+    qreal x = re[l];
+    re[l] = x * d.real() - im[l] * d.imag();
+    im[l] = x * d.imag() + im[l] * d.real();
+  }
+}
+
+// Number of qubits indexing within one rank's chunk
+inline int local_qubits(Qureg qureg) {
+  int local = 0;
+  while ((1LL << (local + 1)) <= qureg.numAmpsPerChunk)
+    local++;
+  return local;
+}
+
+// Runs a block list and returns the number of passes over the state vector.
+// Consecutive blocks on qubits below cache_qubits are applied together, one
+// cache-sized tile of 2^cache_qubits amplitudes at a time, so the whole run
+// costs a single pass. Every other block is one diagonal pass, or one QuEST
+// call.
+inline long apply_gates(Qureg qureg, std::vector<Gate> const& blocks, int cache_qubits) {
+  long long chunk = qureg.numAmpsPerChunk;
+  int local = local_qubits(qureg);
+  int tile_qubits = std::min(cache_qubits, local);
+  long long tile = 1LL << tile_qubits;
+
+  long passes = 0;
+  size_t i = 0;
+  while (i < blocks.size()) {
+    if (blocks[i].qubits.back() >= tile_qubits) {
+      if (is_diagonal(blocks[i]))
+        apply_diagonal(qureg, blocks[i++]);
+      else
+        apply_quest(qureg, blocks[i++]);
+      passes++;
+      continue;
+    }
+
+    size_t j = i;
+    while (j < blocks.size() && blocks[j].qubits.back() < tile_qubits)
+      j++;
+
+    qreal* re = qureg.stateVec.real;
+    qreal* im = qureg.stateVec.imag;
+#   pragma omp parallel for schedule(static)
+    for (long long t = 0; t < chunk / tile; t++)
+      for (size_t b = i; b < j; b++)
+        apply_block(re + t * tile, im + t * tile, tile, blocks[b]);
+
+    passes++;
+    i = j;
+  }
+
+  return passes;
+}
+
+
+// ========================================================================= //
+// ------------------------------ Scheduling ------------------------------- //
+// ========================================================================= //
+
+// Plans a gate list for a register whose lowest local qubits index within
+// each rank's chunk. Whenever a non-diagonal gate needs a global qubit, the
+// local set is refilled with the local qubits used soonest (looking ahead in
+// the list), and every global qubit in that set is swapped with a local one
+// that is not, in one batched exchange. Diagonal gates run wherever their
+// qubits are. map is updated to the layout the schedule ends in.
+inline std::vector<Step> schedule_gates(std::vector<Gate> const& gates, QubitMap& map, int local,
+                                        ScheduleStats& stats, long long chunk) {
+  int n = map.physical.size();
+  std::vector<bool> diagonal;
+  std::vector<std::vector<int>> uses(n);
+  for (size_t i = 0; i < gates.size(); i++) {
+    diagonal.push_back(is_diagonal(gates[i]));
+    if (!diagonal[i])
+      for (int q : gates[i].qubits)
+        uses[q].push_back(i);
+  }
+
+  stats.exchanges = stats.bytes = 0;
+  std::vector<size_t> cursor(n, 0);
+  std::vector<Step> steps;
+  for (size_t i = 0; i < gates.size(); i++) {
+    bool remote = false;
+    for (int q : gates[i].qubits)
+      remote |= map.physical[q] >= local;
+
+    if (remote && !diagonal[i]) {
+      std::vector<long> next(n);
+      for (int q = 0; q < n; q++) {
+        while (cursor[q] < uses[q].size() && uses[q][cursor[q]] < (int) i)
+          cursor[q]++;
+        next[q] = cursor[q] < uses[q].size() ? uses[q][cursor[q]] : LONG_MAX;
+      }
+
+      // Soonest used first, and on ties keep what is already local
+      std::vector<int> order(n);
+      for (int q = 0; q < n; q++)
+        order[q] = q;
+      std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        if (next[a] != next[b])
+          return next[a] < next[b];
+        return map.physical[a] < local && map.physical[b] >= local;
+      });
+
+      std::vector<int> incoming, outgoing;
+      for (int r = 0; r < n; r++) {
+        int q = order[r];
+        if (r < local && map.physical[q] >= local)
+          incoming.push_back(q);
+        if (r >= local && map.physical[q] < local)
+          outgoing.push_back(q);
+      }
+
+      Step step;
+      for (size_t j = 0; j < incoming.size(); j++) {
+        step.swaps.push_back({map.physical[incoming[j]], map.physical[outgoing[j]]});
+        std::swap(map.physical[incoming[j]], map.physical[outgoing[j]]);
+      }
+      steps.push_back(step);
+
+      stats.exchanges++;
+      stats.bytes += 2 * (chunk - (chunk >> incoming.size())) * sizeof(qreal);
+    }
+
+    Step step;
+    step.gate = relabel_gate(gates[i], map);
+    steps.push_back(step);
+  }
+
+  return steps;
+}
+
+// Fills in the naive side of stats: QuEST exchanges the whole chunk with a
+// partner rank for every global target of a non-diagonal gate
+inline void naive_schedule(std::vector<Gate> const& gates, int local, ScheduleStats& stats,
+                           long long chunk) {
+  stats.naive_exchanges = stats.naive_bytes = 0;
+  for (auto const& gate : gates)
+    if (!is_diagonal(gate))
+      for (int q : gate.qubits)
+        if (q >= local) {
+          stats.naive_exchanges++;
+          stats.naive_bytes += 2 * chunk * sizeof(qreal);
+        }
+}
+
+// Swaps each global physical qubit in swaps with its local partner in a
+// single all-to-all among the 2^k ranks that differ only in those global bits.
+// Amplitudes are packed by destination into pairStateVec, exchanged into
+// stateVec, and unpacked through pairStateVec again.
+inline void exchange_qubits(Qureg qureg, std::vector<std::pair<int, int>> const& swaps) {
+#ifdef DISTRIBUTED_BUILD
+  int k = swaps.size();
+  int local = local_qubits(qureg);
+  long long chunk = qureg.numAmpsPerChunk;
+  long long block = chunk >> k;
+
+  int mask = 0, key = 0;
+  std::vector<int> positions;
+  for (int j = 0; j < k; j++) {
+    mask |= 1 << (swaps[j].first - local);
+    key |= (qureg.chunkId >> (swaps[j].first - local) & 1) << j;
+    positions.push_back(swaps[j].second);
+  }
+  std::sort(positions.begin(), positions.end());
+
+  MPI_Comm comm;
+  MPI_Comm_split(MPI_COMM_WORLD, qureg.chunkId & ~mask, key, &comm);
+
+  // Local index of element c of the block for partner p
+  auto index = [&](long long p, long long c) {
+    for (int pos : positions) {
+      long long low = c & ((1LL << pos) - 1);
+      c = ((c ^ low) << 1) | low;
+    }
+    for (int j = 0; j < k; j++)
+      c |= (p >> j & 1) << swaps[j].second;
+    return c;
+  };
+
+  // Large chunks overflow int counts, so send blocks in units of 2^20 amps
+  long long unit = std::min(block, 1LL << 20);
+  MPI_Datatype type;
+  MPI_Type_contiguous(unit * sizeof(qreal), MPI_BYTE, &type);
+  MPI_Type_commit(&type);
+
+  qreal* arrays[2] = {qureg.stateVec.real, qureg.stateVec.imag};
+  qreal* buffers[2] = {qureg.pairStateVec.real, qureg.pairStateVec.imag};
+  for (int a = 0; a < 2; a++) {
+#   pragma omp parallel for schedule(static)
+    for (long long e = 0; e < chunk; e++)
+      buffers[a][e] = arrays[a][index(e / block, e % block)];
+
+    MPI_Alltoall(buffers[a], block / unit, type, arrays[a], block / unit, type, comm);
+
+#   pragma omp parallel for schedule(static)
+    for (long long e = 0; e < chunk; e++)
+      buffers[a][index(e / block, e % block)] = arrays[a][e];
+    memcpy(arrays[a], buffers[a], chunk * sizeof(qreal));
+  }
+
+  MPI_Type_free(&type);
+  MPI_Comm_free(&comm);
+#else
+  for (auto const& swap : swaps)
+    swapGate(qureg, swap.first, swap.second);
+#endif
+}
+
+// Runs a schedule and returns the number of passes over the state vector
+inline long run_schedule(Qureg qureg, std::vector<Step> const& steps, int cache_qubits) {
+  long passes = 0;
+  std::vector<Gate> blocks;
+  for (auto const& step : steps) {
+    if (step.swaps.empty()) {
+      blocks.push_back(step.gate);
+      continue;
+    }
+
+    passes += apply_gates(qureg, blocks, cache_qubits);
+    blocks.clear();
+    exchange_qubits(qureg, step.swaps);
+    passes++;
+  }
+
+  return passes + apply_gates(qureg, blocks, cache_qubits);
+}
+
+
+// ========================================================================= //
+// ------------------------------- Accuracy -------------------------------- //
+// ========================================================================= //
+
+// Total probability, summed per rank in acc_real
+inline double total_prob(Qureg qureg) {
+  qreal* re = qureg.stateVec.real;
+  qreal* im = qureg.stateVec.imag;
+  acc_real sum = 0;
+
+# pragma omp parallel for reduction(+:sum)
+  for (long long i = 0; i < qureg.numAmpsPerChunk; i++)
+    sum += (acc_real) re[i] * re[i] + (acc_real) im[i] * im[i];
+
+  double total = sum;
+#ifdef DISTRIBUTED_BUILD
+  MPI_Allreduce(MPI_IN_PLACE, &total, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+  return total;
+}
+
+// Real and imaginary parts of the amplitudes at count evenly spaced logical
+// indices, the same in every build, for comparing builds of one circuit
+inline std::vector<double> sample_amps(Qureg qureg, QubitMap const& map, int count) {
+  std::vector<double> amps;
+  for (int k = 0; k < count; k++) {
+    Complex amp = get_amp(qureg, map, qureg.numAmpsTotal / count * k);
+    amps.push_back(amp.real);
+    amps.push_back(amp.imag);
+  }
+  return amps;
+}
+
+
+// ========================================================================= //
+// ------------------------------- Planning -------------------------------- //
+// ========================================================================= //
+
+// Bytes one rank holds for an n-qubit register over ranks ranks: the real and
+// imaginary arrays of its chunk, and as much again for pairStateVec, which
+// QuEST allocates whenever it is distributed
+inline double state_bytes(int nqubits, int ranks) {
+  double chunk = std::ldexp(2.0 * sizeof(qreal), nqubits) / ranks;
+  return ranks > 1 ? 2 * chunk : chunk;
+}
+
+// Adds the passes apply_gates makes over blocks on chunks of 2^local amps
+inline void count_passes(std::vector<Gate> const& blocks, int local, int cache_qubits, PassPlan& plan) {
+  int tile_qubits = std::min(cache_qubits, local);
+  size_t i = 0;
+  while (i < blocks.size()) {
+    if (blocks[i].qubits.back() >= tile_qubits) {
+      plan.diagonal += is_diagonal(blocks[i++]);
+      plan.passes++;
+      continue;
+    }
+
+    while (i < blocks.size() && blocks[i].qubits.back() < tile_qubits)
+      i++;
+    plan.passes++;
+  }
+}
+
+// Gates issued one QuEST call at a time: a pass each, and the exchanges of
+// naive_schedule
+inline PassPlan plan_gates(std::vector<Gate> const& gates, int local) {
+  ScheduleStats stats;
+  naive_schedule(gates, local, stats, 1LL << local);
+
+  PassPlan plan = {(long) gates.size(), 0, stats.naive_exchanges, stats.naive_bytes};
+  for (auto const& gate : gates)
+    plan.diagonal += is_diagonal(gate);
+  return plan;
+}
+
+// Fused blocks run through apply_gates
+inline PassPlan plan_fused(std::vector<Gate> const& blocks, int local, int cache_qubits) {
+  PassPlan plan = plan_gates(blocks, local);
+  plan.passes = plan.diagonal = 0;
+  count_passes(blocks, local, cache_qubits, plan);
+  return plan;
+}
+
+// Fused blocks run through schedule_gates and run_schedule, counting passes
+// the way run_schedule does
+inline PassPlan plan_scheduled(std::vector<Gate> const& blocks, int nqubits, int local,
+                               int cache_qubits) {
+  QubitMap map(nqubits);
+  ScheduleStats stats;
+  std::vector<Step> steps = schedule_gates(blocks, map, local, stats, 1LL << local);
+
+  PassPlan plan = {0, 0, stats.exchanges, stats.bytes};
+  std::vector<Gate> run;
+  for (auto const& step : steps) {
+    if (step.swaps.empty()) {
+      run.push_back(step.gate);
+      continue;
+    }
+
+    count_passes(run, local, cache_qubits, plan);
+    run.clear();
+    plan.passes++;
+  }
+  count_passes(run, local, cache_qubits, plan);
+  return plan;
+}
+
+template <class Pass>
+inline double time_pass(QuESTEnv env, Qureg qureg, int reps, Pass pass) {
+  syncQuESTEnv(env);
+  auto tstart = std::chrono::steady_clock::now();
+  for (int r = 0; r < reps; r++)
+    pass(r);
+  syncQuESTEnv(env);
+  auto tstop = std::chrono::steady_clock::now();
+
+  double bytes = 2.0 * sizeof(qreal) * qureg.numAmpsPerChunk;
+  return std::chrono::duration<double, std::milli>(tstop - tstart).count() / reps / bytes;
+}
+
+// Calibrates the passes of an n-qubit register on reps Hadamards and reps
+// controlled phase shifts on its lowest qubits, which are local on any rank
+inline PassRates calibrate_passes(QuESTEnv env, int nqubits, int reps) {
+  Qureg qureg = createQureg(nqubits, env);
+  initPlusState(qureg);
+  hadamard(qureg, 0);
+
+  PassRates rates;
+  rates.dense = time_pass(env, qureg, reps, [&](int r) { hadamard(qureg, r % 2); });
+  rates.diagonal = time_pass(env, qureg, reps, [&](int r) {
+    controlledPhaseShift(qureg, r % 2, 2, 0.5);
+  });
+
+  destroyQureg(qureg, env);
+  return rates;
+}
+
+// Runtime at freq of a pass plan over chunks of chunk_bytes, with rates
+// calibrated at cal. Passes are memory-bound; exchanges run at the network
+// bandwidth whatever the frequency.
+inline double plan_pass_ms(PassPlan const& plan, PassRates const& rates, double chunk_bytes,
+                           PlanFreq const& cal, PlanFreq const& freq) {
+  double ms = ((plan.passes - plan.diagonal) * rates.dense + plan.diagonal * rates.diagonal) * chunk_bytes;
+  return plan_scale(ms, cal, freq, true) + plan.bytes / PLAN_NET_BYTES_PER_S * 1000;
+}
+
+#endif
@@ -1,9 +1,15 @@
+#include <array>
 #include <bitset>
 #include <chrono>
 #include <cmath>
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include "QuEST.h"
+#include "gates.h"
+#include "../common/harness.h"
+#include "../common/energy.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -11,26 +17,55 @@
 
 #define QREG_DEFAULT 24
 #define QREG_MAX 32
-#define PRECISION 1E-10
+#define PRECISION (sizeof(qreal) == 4 ? 1E-6 : 1E-10)
+#define MODE_DEFAULT "gates"
+#define SWAPS_DEFAULT "swap"
+#define SAMPLE_AMPS 16
+#define CACHE_QUBITS 14
+#define SWEEP_SEGMENT 4096
+#define AQFT_DEFAULT 0
+#define CALIBRATION_QUBITS 26
+#define CALIBRATION_REPS 8
 
 using namespace std;
 
 
-void qft(Qureg qureg);
+void qft(Qureg qureg, QubitMap& map, int aqft_k);
+void qft_fused(Qureg qureg, QubitMap& map, int aqft_k);
+void qft_scheduled(Qureg qureg, QubitMap& map, ScheduleStats& stats, int aqft_k);
+vector<Gate> qft_gates(int nqubits, int aqft_k);
+long skipped_rotations(int nqubits, int aqft_k);
+void plan_qft(QuESTEnv env, int qreg_size, string const& mode, string const& swaps, int validate,
+              int aqft_k, Harness const& harness);
 
-bool operator==(Complex const& lhs, Complex const& rhs);
-void validate_result(QuESTEnv env, Qureg& qureg);
-void print_qureg(Qureg qureg);
+void validate_result(QuESTEnv env, Qureg& qureg, QubitMap const& map, long long input);
+void print_qureg(Qureg qureg, QubitMap const& map);
 
-void set_args(int argc, char* argv[], int& qreg_size);
+void set_args(int argc, char* argv[], int& qreg_size, string& mode, string& swaps,
+              int& validate, int& aqft_k, long long& input, int& plan, Harness& harness);
 int set_verbose();
 
 
 int main(int argc, char *argv[]) {
   // Set number of qubits and verbosity
   int qreg_size = QREG_DEFAULT;
-
-  set_args(argc, argv, qreg_size);
+  string mode = MODE_DEFAULT;
+  string swaps = SWAPS_DEFAULT;
+  int validate = 0;
+  int aqft_k = AQFT_DEFAULT;
+  long long input = 0;
+  int plan = 0;
+  Harness harness("quest-qft");
+
+  set_args(argc, argv, qreg_size, mode, swaps, validate, aqft_k, input, plan, harness);
+  if (aqft_k < 0)
+    throw invalid_argument("AQFT threshold must be positive, or 0 for the exact QFT");
+  if (input < 0 || input >> qreg_size)
+    throw invalid_argument("Input must be a basis state of " + to_string(qreg_size) + " qubits");
+  if (mode != "gates" && mode != "fused" && mode != "scheduled")
+    throw invalid_argument("Unknown mode, please use one of the following: 'gates', 'fused', 'scheduled'");
+  if (swaps != "swap" && swaps != "map" && swaps != "materialise")
+    throw invalid_argument("Unknown swaps, please use one of the following: 'swap', 'map', 'materialise'");
   int verbose = set_verbose();
 
   // Prepare the hardware-agnostic QuEST environment
@@ -40,34 +75,105 @@ int main(int argc, char *argv[]) {
     cout << "Verbose is ON" << endl;
     cout << "No. processes: " << env.numRanks << endl; 
     cout << "No. qubits: " << qreg_size << endl;
+    cout << "Mode: " << mode << endl;
+    cout << "Swaps: " << swaps << endl;
+    if (aqft_k > 0)
+      cout << "AQFT threshold: " << aqft_k << endl;
   }
 
-  Qureg qureg = createQureg(qreg_size, env);
-  initZeroState(qureg);
+  // Predict the resources of this run instead of simulating it
+  if (plan) {
+    plan_qft(env, qreg_size, mode, swaps, validate || verbose, aqft_k, harness);
+    destroyQuESTEnv(env);
+    return 0;
+  }
 
-  // Sync and start timer
+  Energy energy = create_energy();
+  energy_start(energy);
+  Qureg qureg = createQureg(qreg_size, env);
+  QubitMap map(qreg_size, swaps != "swap");
+  ScheduleStats stats;
   syncQuESTEnv(env);
-  auto tstart = chrono::steady_clock::now();
+  energy_stop(energy, "init");
+
+  // Reset the state and sync before every repetition, run QFT and sync in it
+  auto reset = [&]() {
+    initClassicalState(qureg, input);
+    map = QubitMap(qreg_size, swaps != "swap");
+    syncQuESTEnv(env);
+  };
+  auto run = [&]() {
+    energy_start(energy);
+    if (mode == "fused")
+      qft_fused(qureg, map, aqft_k);
+    else if (mode == "scheduled")
+      qft_scheduled(qureg, map, stats, aqft_k);
+    else
+      qft(qureg, map, aqft_k);
 
-  // Run QFT
-  qft(qureg);
-  
-  // Sync and stop timer
-  syncQuESTEnv(env);
-  auto tstop = chrono::steady_clock::now();
+    if (swaps == "materialise")
+      materialise(qureg, map);
+    syncQuESTEnv(env);
+    energy_stop(energy, "circuit", harness);
+  };
+
+  double tdiff = harness_run(harness, reset, run);
 
-  double tdiff = chrono::duration<double, milli>(tstop - tstart).count();
+  // Collective reads, for comparing builds of different precision
+  double norm = total_prob(qureg);
+  vector<double> amps = sample_amps(qureg, map, SAMPLE_AMPS);
+  long skipped = skipped_rotations(qreg_size, aqft_k);
+  long rotations = (long) qreg_size * (qreg_size - 1) / 2;
 
   if (env.rank == 0) {
     if (verbose) 
       cout << "Time taken: " << tdiff << " ms" << endl;
     else 
       cout << tdiff << endl;
+    if (verbose)
+      cout << "Norm: " << norm << " (" << PRECISION_NAME << " precision)" << endl;
+
+    if (verbose && mode == "scheduled") {
+      cout << "Exchanges: " << stats.exchanges << " (naive: " << stats.naive_exchanges << ")" << endl;
+      cout << "Bytes sent per rank: " << stats.bytes << " (naive: " << stats.naive_bytes << ")" << endl;
+    }
+    if (verbose && aqft_k > 0)
+      cout << "Skipped rotations: " << skipped << " of " << rotations << endl;
   }
 
-  // Validate whether all coefficients are the same
-  if (verbose)
-    validate_result(env, qureg);
+  // Validate against the exact QFT of the input
+  if (verbose || validate) {
+    energy_start(energy);
+    validate_result(env, qureg, map, input);
+    energy_stop(energy, "validation");
+  }
+
+#ifdef DISTRIBUTED_BUILD
+  energy_reduce(energy);
+#endif
+  if (env.rank == 0 && verbose)
+    energy_print(energy, cout);
+
+  harness.rank = env.rank;
+  harness_param(harness, "qubits", qreg_size);
+  harness_param(harness, "mode", mode);
+  harness_param(harness, "swaps", swaps);
+  harness_param(harness, "aqft_k", aqft_k);
+  harness_param(harness, "input", input);
+  harness_param(harness, "ranks", env.numRanks);
+  harness_param(harness, "threads", harness_threads());
+  harness_param(harness, "precision", (int) sizeof(qreal));
+  harness_param(harness, "precision_mode", PRECISION_NAME);
+  harness_metric(harness, "norm", norm);
+  harness_metric(harness, "amps", amps);
+  if (mode == "scheduled") {
+    harness_metric(harness, "exchanges", stats.exchanges);
+    harness_metric(harness, "bytes_sent", stats.bytes);
+  }
+  if (aqft_k > 0)
+    harness_metric(harness, "skipped_rotations", skipped);
+  energy_metrics(energy, harness);
+  harness_write(harness);
   
   // Free memory
   destroyQureg(qureg, env);
@@ -78,56 +184,269 @@ int main(int argc, char *argv[]) {
 
 
 void crot(Qureg qureg, int targetQubit, int controlQubit, int k) {
-  unsigned long frac = 1 << k;
-  controlledPhaseShift(qureg, targetQubit, controlQubit, 2 * M_PI / frac);
+  controlledPhaseShift(qureg, targetQubit, controlQubit, 2 * M_PI / ldexp(1.0, k));
 }
 
-void multi_crot(Qureg qureg, int targetQubit) {
+// Rotations with k above aqft_k (if not 0) are dropped, which is the
+// approximate QFT
+void multi_crot(Qureg qureg, int targetQubit, int aqft_k) {
   for (int i = 2; i <= qureg.numQubitsRepresented - targetQubit; i++)
-    crot(qureg, targetQubit, targetQubit + i - 1, i);
+    if (aqft_k == 0 || i <= aqft_k)
+      crot(qureg, targetQubit, targetQubit + i - 1, i);
+}
+
+long skipped_rotations(int nqubits, int aqft_k) {
+  long skipped = 0;
+  for (int i = 0; aqft_k > 0 && i < nqubits; i++)
+    skipped += max(0, nqubits - i - max(aqft_k, 1));
+  return skipped;
 }
 
-void swap_qureg(Qureg qureg) {
+// Reverses the qubit order, which is only a relabelling when map is lazy
+void swap_qureg(Qureg qureg, QubitMap& map) {
   int n = qureg.numQubitsRepresented;
   for (int i = 0; i < n / 2; i++)
-    swapGate(qureg, i, n - i - 1);
+    swap_qubits(qureg, map, i, n - i - 1);
+}
+
+void qft(Qureg qureg, QubitMap& map, int aqft_k) {
+  for (int i = 0; i < qureg.numQubitsRepresented; i++) {
+    hadamard(qureg, i);
+    multi_crot(qureg, i, aqft_k);
+  }
+
+  swap_qureg(qureg, map);
+}
+
+// All CROTs targeting qubit i commute and together multiply each amplitude with
+// bit i set by exp(2 pi i * sum_j b_(i+1+j) / 2^(j+2)), which depends only on
+// the index bits above i. The phase is assembled from one table per byte of
+// those bits, and is constant over runs of 2^i contiguous amplitudes, so the
+// inner loops are plain scaled copies over the local chunk. Being diagonal,
+// the pass needs no communication between ranks. Bits whose rotation has k
+// above aqft_k (if not 0) get no phase.
+void phase_sweep(Qureg qureg, int targetQubit, int aqft_k) {
+  int n = qureg.numQubitsRepresented;
+  int nbytes = (n - targetQubit - 1 + 7) / 8;
+  long long chunk = qureg.numAmpsPerChunk;
+  long long offset = qureg.chunkId * chunk;
+  long long half = 1LL << targetQubit;
+  qreal* re = qureg.stateVec.real;
+  qreal* im = qureg.stateVec.imag;
+
+  vector<array<qreal, 256>> tableRe(nbytes), tableIm(nbytes);
+  for (int b = 0; b < nbytes; b++)
+    for (int v = 0; v < 256; v++) {
+      double angle = 0;
+      for (int j = 0; j < 8; j++)
+        if (v >> j & 1 && (aqft_k == 0 || 8 * b + j + 2 <= aqft_k))
+          angle += 2 * M_PI / pow(2.0, 8 * b + j + 2);
+      tableRe[b][v] = cos(angle);
+      tableIm[b][v] = sin(angle);
+    }
+
+  auto phase = [&](long long high, qreal& pr, qreal& pi) {
+    pr = 1; pi = 0;
+    for (int b = 0; b < nbytes; b++) {
+      int v = (high >> (8 * b)) & 255;
+      qreal r = pr * tableRe[b][v] - pi * tableIm[b][v];
+      pi = pr * tableIm[b][v] + pi * tableRe[b][v];
+      pr = r;
+    }
+  };
+
+  long long start, stop, stride;
+  if (half >= chunk) {
+    // Bit i is fixed on this chunk, so the whole chunk shares one phase
+    if (!(offset & half))
+      return;
+    start = 0; stop = chunk; stride = chunk;
+  } else {
+    start = half; stop = 2 * half; stride = 2 * half;
+  }
+
+  // Runs are cut into segments so that all threads share the work even when
+  // there are fewer runs than threads, as for high or global targets
+  long long blocks = chunk / stride;
+  long long segment = min(stop - start, (long long) SWEEP_SEGMENT);
+  long long segments = (stop - start) / segment;
+# pragma omp parallel for schedule(static)
+  for (long long t = 0; t < blocks * segments; t++) {
+    long long base = t / segments * stride;
+    long long first = start + t % segments * segment;
+    qreal pr, pi;
+    phase((offset + base) >> (targetQubit + 1), pr, pi);
+
+    qreal* __restrict__ r = re + base;
+    qreal* __restrict__ m = im + base;
+#   pragma omp simd
+    for (long long k = first; k < first + segment; k++) {
+      qreal x = r[k];
+      r[k] = x * pr - m[k] * pi;
+      m[k] = x * pi + m[k] * pr;
+    }
+  }
 }
 
-void qft(Qureg qureg) {
+// Same circuit as qft, with each Hadamard followed by one fused phase pass
+// instead of up to n - 1 controlled phase shifts
+void qft_fused(Qureg qureg, QubitMap& map, int aqft_k) {
   for (int i = 0; i < qureg.numQubitsRepresented; i++) {
     hadamard(qureg, i);
-    multi_crot(qureg, i);
+    phase_sweep(qureg, i, aqft_k);
+  }
+
+  swap_qureg(qureg, map);
+}
+
+
+// Same circuit as qft, with the gates run through the communication-avoiding
+// schedule and the final reversal left to swap_qureg
+void qft_scheduled(Qureg qureg, QubitMap& map, ScheduleStats& stats, int aqft_k) {
+  vector<Gate> gates = qft_gates(qureg.numQubitsRepresented, aqft_k);
+  int local = local_qubits(qureg);
+  naive_schedule(gates, local, stats, qureg.numAmpsPerChunk);
+  vector<Step> steps = schedule_gates(gates, map, local, stats, qureg.numAmpsPerChunk);
+  run_schedule(qureg, steps, CACHE_QUBITS);
+
+  swap_qureg(qureg, map);
+}
+
+// Gates of the QFT up to the final reversal, in the order qft applies them
+vector<Gate> qft_gates(int nqubits, int aqft_k) {
+  int last = aqft_k > 0 ? aqft_k : nqubits;
+  vector<Gate> gates;
+  for (int i = 0; i < nqubits; i++) {
+    gates.push_back(hadamard_gate(i));
+    for (int k = 2; k <= min(nqubits - i, last); k++)
+      gates.push_back(phase_gate(i, i + k - 1, 2 * M_PI / ldexp(1.0, k)));
+  }
+
+  return gates;
+}
+
+// Prints the memory per node, runtime and energy of this run on every node
+// count and frequency it fits, from passes calibrated on this machine. Each
+// phase_sweep of the fused mode counts as one diagonal gate, the swaps of
+// the reversal (unless only mapped) as one gate each, and validation as one
+// diagonal pass.
+void plan_qft(QuESTEnv env, int qreg_size, string const& mode, string const& swaps, int validate,
+              int aqft_k, Harness const& harness) {
+  int n = qreg_size;
+  vector<Gate> gates;
+  if (mode == "fused") {
+    for (int i = 0; i < n; i++) {
+      gates.push_back(hadamard_gate(i));
+      if (i < n - 1)
+        gates.push_back(phase_gate(i, i + 1, M_PI / 2));
+    }
+  } else {
+    gates = qft_gates(n, aqft_k);
   }
 
-  swap_qureg(qureg);
+  vector<Gate> reversal;
+  for (int i = 0; swaps != "map" && i < n / 2; i++) {
+    Gate swap = {{i, n - i - 1}, vector<complex<qreal>>(16)};
+    swap.matrix[0] = swap.matrix[6] = swap.matrix[9] = swap.matrix[15] = 1;
+    reversal.push_back(swap);
+  }
+
+  int calibration_qubits = min(n, CALIBRATION_QUBITS);
+  PlanFreq cal = plan_current_freq();
+  PassRates rates = calibrate_passes(env, calibration_qubits, CALIBRATION_REPS);
+
+  auto node_bytes = [&](int nodes) { return state_bytes(n, nodes); };
+  auto node_ms = [&](int nodes, PlanFreq const& freq) {
+    int local = n - (int) log2(nodes);
+    double chunk = ldexp(2.0 * sizeof(qreal), local);
+    PassPlan circuit = mode == "scheduled" ? plan_scheduled(gates, n, local, CACHE_QUBITS)
+                                           : plan_gates(gates, local);
+    PassPlan check = {validate, validate, 0, 0};
+    double run = plan_pass_ms(circuit, rates, chunk, cal, freq) +
+      plan_pass_ms(plan_gates(reversal, local), rates, chunk, cal, freq);
+    return (harness.warmup + harness.reps) * run + plan_pass_ms(check, rates, chunk, cal, freq);
+  };
+  int max_nodes = min(PLAN_MAX_NODES, 1 << min(n - 2, 30));
+  auto configs = plan_configs(max_nodes, node_bytes, node_ms);
+
+  if (env.rank == 0) {
+    cout << "Plan for " << n << " qubits, mode " << mode << ", " << PRECISION_NAME
+         << " precision" << endl;
+    cout << "Calibration at " << cal.name << " on " << calibration_qubits << " qubits: dense pass "
+         << 2 / (rates.dense * 1E6) << " GB/s, diagonal pass " << 2 / (rates.diagonal * 1E6)
+         << " GB/s" << endl;
+    plan_print(cout, configs, max_nodes);
+  }
 }
 
 
-bool operator==(Complex const& lhs, Complex const& rhs) {
-  return (fabs(lhs.real - rhs.real) < PRECISION) &&
-    (fabs(lhs.imag - rhs.imag) < PRECISION);
+// Reverses the lowest n bits of x
+unsigned long long reverse_bits(unsigned long long x, int n) {
+  unsigned long long r = 0;
+  for (int q = 0; q < n; q++)
+    r |= (x >> q & 1) << (n - q - 1);
+  return r;
 }
 
-void validate_result(QuESTEnv env, Qureg& qureg) {
-  unsigned long numStates = 1 << qureg.numQubitsRepresented;
-  Complex ampZero = getAmp(qureg, 0);
-  bool isValid = true;
+// The circuit treats qubit 0 as the most significant bit, so the exact QFT of
+// |x> has amplitude exp(2 pi i rev(x) rev(y) / 2^n) / sqrt(2^n) at |y>. For
+// |0..0> that is the uniform state, whatever the qubit layout. Each rank
+// checks its own chunk in place, translating stored indices back through map,
+// and only the max deviation, the squared error and the overlap with the
+// exact state are reduced across ranks. The fidelity is that of an
+// approximate QFT.
+void validate_result(QuESTEnv env, Qureg& qureg, QubitMap const& map, long long input) {
+  int n = qureg.numQubitsRepresented;
+  unsigned long long mask = (1ULL << n) - 1;
+  unsigned long long rx = reverse_bits(input, n);
+  acc_real expected = 1 / sqrt((acc_real) qureg.numAmpsTotal);
+  qreal* re = qureg.stateVec.real;
+  qreal* im = qureg.stateVec.imag;
+  long long offset = qureg.chunkId * qureg.numAmpsPerChunk;
+  acc_real accMax = 0, accSq = 0, accRe = 0, accIm = 0;
+
+# pragma omp parallel for reduction(max:accMax) reduction(+:accSq,accRe,accIm)
+  for (long long i = 0; i < qureg.numAmpsPerChunk; i++) {
+    acc_real er = expected, ei = 0;
+    if (input != 0) {
+      unsigned long long y = 0;
+      for (int q = 0; q < n; q++)
+        y |= ((unsigned long long) (offset + i) >> map.physical[q] & 1) << q;
+      unsigned long long turns = (unsigned long long) ((unsigned __int128) rx * reverse_bits(y, n)) & mask;
+      double angle = 2 * M_PI * turns / pow(2.0, n);
+      er = expected * cos(angle);
+      ei = expected * sin(angle);
+    }
+    acc_real dev = (re[i] - er) * (re[i] - er) + (im[i] - ei) * (im[i] - ei);
+    accSq += dev;
+    accMax = max(accMax, sqrt(dev));
+    accRe += er * re[i] + ei * im[i];
+    accIm += er * im[i] - ei * re[i];
+  }
+  double maxDev = accMax, sumSq = accSq, overlapRe = accRe, overlapIm = accIm;
 
-  for (int i = 1; i < numStates && isValid; i++)
-    isValid = getAmp(qureg, i) == ampZero;
+#ifdef DISTRIBUTED_BUILD
+  MPI_Allreduce(MPI_IN_PLACE, &maxDev, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, &sumSq, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, &overlapRe, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, &overlapIm, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
 
   if (env.rank == 0) {
-    if (isValid) 
+    if (maxDev < PRECISION) 
       cout << "Result valid" << endl;
     else
       cout << "Result invalid" << endl;
+    cout << "Max deviation: " << maxDev << endl;
+    cout << "L2 error: " << sqrt(sumSq) << endl;
+    cout << "Fidelity vs exact QFT: " << overlapRe * overlapRe + overlapIm * overlapIm << endl;
   }
 }
 
-void print_qureg(Qureg qureg) {
-  int numStates = 1 << qureg.numQubitsRepresented;
-  for (int i = 0; i < numStates; i++) {
-    Complex amp = getAmp(qureg, i);
+void print_qureg(Qureg qureg, QubitMap const& map) {
+  long long numStates = 1LL << qureg.numQubitsRepresented;
+  for (long long i = 0; i < numStates; i++) {
+    Complex amp = get_amp(qureg, map, i);
     bitset<QREG_MAX> ibits(i);
 
     cout << "Probability of |" << ibits << ">: ";
@@ -136,17 +455,39 @@ void print_qureg(Qureg qureg) {
 }
 
 
-void set_args(int argc, char* argv[], int& qreg_size) {
+void set_args(int argc, char* argv[], int& qreg_size, string& mode, string& swaps,
+              int& validate, int& aqft_k, long long& input, int& plan, Harness& harness) {
   for (int i = 1; i < argc; i++) {
     string arg = argv[i];
     if (arg == "-q") {
       qreg_size = atoi(argv[++i]);
+    } else if (arg == "-m") {
+      mode = argv[++i];
+    } else if (arg == "-s") {
+      swaps = argv[++i];
+    } else if (arg == "-v") {
+      validate = 1;
+    } else if (arg == "-a") {
+      aqft_k = atoi(argv[++i]);
+    } else if (arg == "-i") {
+      input = atoll(argv[++i]);
+    } else if (arg == "-p") {
+      plan = 1;
+    } else if (arg == "-w") {
+      harness.warmup = atoi(argv[++i]);
+    } else if (arg == "-n") {
+      harness.reps = atoi(argv[++i]);
+    } else if (arg == "-j") {
+      harness.json_path = argv[++i];
     } else {
       string message = "Error: Unknown argument '" + arg + 
-        "'! Use: ./bin -q $NQUBITS";
+        "'! Use: ./bin -q $NQUBITS -m $MODE -s $SWAPS [-v] [-a $AQFT_K -i $INPUT] [-p] [-w $WARMUP -n $REPS -j $JSON]";
       throw invalid_argument(message);
     }
   }
+
+  if (harness.warmup < 0 || harness.reps < 1)
+    throw invalid_argument("Error: -w must be at least 0 and -n at least 1");
 }
 
 int set_verbose() {
@@ -2,8 +2,14 @@
 #include <chrono>
 #include <cmath>
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include "QuEST.h"
+#include "gates.h"
+#include "checkpoint.h"
+#include "../common/harness.h"
+#include "../common/energy.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -12,13 +18,41 @@
 #define QREG_DEFAULT 24
 #define QREG_MAX 32
 #define DEPTH_DEFAULT 16
+#define MODE_DEFAULT "gates"
+#define FUSE_DEFAULT 3
+#define FUSE_MAX 5
+#define SAMPLE_AMPS 16
+#define CACHE_DEFAULT 14
+#define CKPT_DEFAULT 0
+#define CKPT_FILE_DEFAULT "rand.ckpt"
+#define CALIBRATION_QUBITS 26
+#define CALIBRATION_REPS 8
 
 using namespace std;
 
-void random_circuit(Qureg qureg, int depth);
+// Layers start to stop of the circuit, one checkpoint interval. Outside gates
+// mode, its fused blocks and, in scheduled mode, its schedule and the layout
+// the state is left in, all built before the timed region.
+struct Segment {
+  int start;
+  int stop;
+  vector<Gate> blocks;
+  vector<Step> steps;
+  QubitMap map;
+};
+
+void random_circuit(Qureg qureg, int first, int last);
+vector<Gate> random_circuit_gates(int nqubits, int first, int last);
+vector<Segment> build_segments(int nqubits, int first, int depth, int every, string const& mode,
+                               int fuse_qubits, int cache_qubits, int local, long long chunk,
+                               QubitMap map, long& ngates, long& nblocks, ScheduleStats& stats);
+void plan_rand(QuESTEnv env, int qreg_size, int depth, string const& mode, int fuse_qubits,
+               int cache_qubits, Harness const& harness);
 
 void print_qureg(Qureg qureg);
-void set_args(int argc, char *argv[], int &qreg_size, int &depth);
+void set_args(int argc, char *argv[], int &qreg_size, int &depth, string &mode,
+              int &fuse_qubits, int &cache_qubits, int &ckpt_every, string &ckpt_file,
+              int &resume, int &plan, Harness &harness);
 int set_verbose();
 
 
@@ -26,8 +60,21 @@ int main(int argc, char *argv[]) {
   // Set number of qubits and verbosity
   int qreg_size = QREG_DEFAULT;
   int depth = DEPTH_DEFAULT;
+  string mode = MODE_DEFAULT;
+  int fuse_qubits = FUSE_DEFAULT;
+  int cache_qubits = CACHE_DEFAULT;
+  int ckpt_every = CKPT_DEFAULT;
+  string ckpt_file = CKPT_FILE_DEFAULT;
+  int resume = 0;
+  int plan = 0;
+  Harness harness("quest-rand");
 
-  set_args(argc, argv, qreg_size, depth);
+  set_args(argc, argv, qreg_size, depth, mode, fuse_qubits, cache_qubits, ckpt_every, ckpt_file,
+           resume, plan, harness);
+  if (mode != "gates" && mode != "fused" && mode != "scheduled")
+    throw invalid_argument("Unknown mode, please use one of the following: 'gates', 'fused', 'scheduled'");
+  if (fuse_qubits < 1 || fuse_qubits > FUSE_MAX)
+    throw invalid_argument("Fused blocks must have between 1 and " + to_string(FUSE_MAX) + " qubits");
   int verbose = set_verbose();
 
   // Prepare the hardware-agnostic QuEST environment
@@ -38,31 +85,139 @@ int main(int argc, char *argv[]) {
     cout << "No. processes: " << env.numRanks << endl; 
     cout << "No. qubits: " << qreg_size << endl;
     cout << "Depth: " << depth << endl;
+    cout << "Mode: " << mode << endl;
   }
 
-  Qureg qureg = createQureg(qreg_size, env);
-  initZeroState(qureg);
+  // Predict the resources of this run instead of simulating it
+  if (plan) {
+    plan_rand(env, qreg_size, depth, mode, fuse_qubits, cache_qubits, harness);
+    destroyQuESTEnv(env);
+    return 0;
+  }
 
-  // Sync and start timer
+  Energy energy = create_energy();
+  energy_start(energy);
+  Qureg qureg = createQureg(qreg_size, env);
+  QubitMap map(qreg_size);
   syncQuESTEnv(env);
-  auto tstart = chrono::steady_clock::now();
+  energy_stop(energy, "init");
+  long ngates = 0, nblocks = 0, passes = 0;
+  ScheduleStats stats = {0, 0, 0, 0};
+  CheckpointStats ckpt = {0, 0, 0};
+  int first = 0;
 
-  // Run QFT
-  random_circuit(qureg, depth);
-  
-  // Sync and stop timer
-  syncQuESTEnv(env);
-  auto tstop = chrono::steady_clock::now();
+  vector<Segment> segments;
+  int built = -1;
+
+  // Start every repetition from |0..0> or from the checkpoint, replaying the
+  // rand() draws of the layers it has applied, and sync. The segments are
+  // built on the first repetition, or again if the checkpoint moved.
+  auto reset = [&]() {
+    map = QubitMap(qreg_size);
+    if (resume)
+      first = read_checkpoint(qureg, map, ckpt_file);
+    else
+      initZeroState(qureg);
+
+    srand(1);
+    for (long d = 0; d < (long) first * qreg_size; d++)
+      rand();
+
+    if (first != built) {
+      segments = build_segments(qreg_size, first, depth, ckpt_every, mode, fuse_qubits, cache_qubits,
+                                local_qubits(qureg), qureg.numAmpsPerChunk, map, ngates, nblocks,
+                                stats);
+      built = first;
+    }
+    passes = 0;
+    ckpt = {0, 0, 0};
+    syncQuESTEnv(env);
+  };
+
+  // Run random circuit, one checkpoint segment at a time
+  auto run = [&]() {
+    energy_start(energy);
+    for (auto const& segment : segments) {
+      if (mode == "fused") {
+        passes += apply_gates(qureg, segment.blocks, cache_qubits);
+      } else if (mode == "scheduled") {
+        // The state ends up in the layout given by map
+        passes += run_schedule(qureg, segment.steps, cache_qubits);
+        map = segment.map;
+      } else {
+        random_circuit(qureg, segment.start, segment.stop);
+      }
 
-  double tdiff = chrono::duration<double, milli>(tstop - tstart).count();
+      if (ckpt_every > 0 && segment.stop < depth)
+        write_checkpoint(qureg, map, segment.stop, ckpt_file, ckpt);
+    }
+    syncQuESTEnv(env);
+    energy_stop(energy, "circuit", harness);
+  };
+
+  double tdiff = harness_run(harness, reset, run);
+
+  // Collective reads, for comparing builds of different precision
+  double norm = total_prob(qureg);
+  vector<double> amps = sample_amps(qureg, map, SAMPLE_AMPS);
+  if (env.rank == 0 && verbose && resume)
+    cout << "Resumed from layer " << first << " of " << depth << endl;
 
   if (env.rank == 0) {
     if (verbose) 
       cout << "Time taken: " << tdiff << " ms" << endl;
     else 
       cout << tdiff << endl;
+    if (verbose)
+      cout << "Norm: " << norm << " (" << PRECISION_NAME << " precision)" << endl;
+
+    if (ckpt.writes > 0)
+      cout << "Checkpoints: " << ckpt.writes << " writes, " << ckpt.bytes / 1E6 << " MB, "
+           << ckpt.bytes / 1E6 / (ckpt.ms / 1000) << " MB/s" << endl;
+
+    if (verbose && mode != "gates") {
+      cout << "Gates: " << ngates << endl;
+      cout << "Fused blocks: " << nblocks << endl;
+      cout << "Passes: " << passes << " (saved " << ngates - passes << ")" << endl;
+    }
+    if (verbose && mode == "scheduled") {
+      cout << "Exchanges: " << stats.exchanges << " (naive: " << stats.naive_exchanges << ")" << endl;
+      cout << "Bytes sent per rank: " << stats.bytes << " (naive: " << stats.naive_bytes << ")" << endl;
+    }
   }
+
+#ifdef DISTRIBUTED_BUILD
+  energy_reduce(energy);
+#endif
+  if (env.rank == 0 && verbose)
+    energy_print(energy, cout);
   
+  harness.rank = env.rank;
+  harness_param(harness, "qubits", qreg_size);
+  harness_param(harness, "depth", depth);
+  harness_param(harness, "mode", mode);
+  harness_param(harness, "fuse_qubits", fuse_qubits);
+  harness_param(harness, "cache_qubits", cache_qubits);
+  harness_param(harness, "ranks", env.numRanks);
+  harness_param(harness, "threads", harness_threads());
+  harness_param(harness, "precision", (int) sizeof(qreal));
+  harness_param(harness, "precision_mode", PRECISION_NAME);
+  harness_metric(harness, "norm", norm);
+  harness_metric(harness, "amps", amps);
+  harness_param(harness, "first_layer", first);
+  if (mode != "gates") {
+    harness_metric(harness, "blocks", nblocks);
+    harness_metric(harness, "passes", passes);
+  }
+  if (mode == "scheduled") {
+    harness_metric(harness, "exchanges", stats.exchanges);
+    harness_metric(harness, "bytes_sent", stats.bytes);
+  }
+  if (ckpt.writes > 0)
+    harness_metric(harness, "checkpoint_mb_per_s", ckpt.bytes / 1E6 / (ckpt.ms / 1000));
+  energy_metrics(energy, harness);
+  harness_write(harness);
+
   // Free memory
   destroyQureg(qureg, env);
   destroyQuESTEnv(env);
@@ -72,11 +227,10 @@ int main(int argc, char *argv[]) {
 
 
 void crot(Qureg qureg, int targetQubit, int controlQubit, int k) {
-  unsigned long frac = 1 << k;
-  controlledPhaseShift(qureg, targetQubit, controlQubit, 2 * M_PI / frac);
+  controlledPhaseShift(qureg, targetQubit, controlQubit, 2 * M_PI / ldexp(1.0, k));
 }
 
-void rand(Qureg qureg, int qubit) {
+Vector random_axis() {
   int r = rand() % 3;
   Vector v;
     if (r == 0) {
@@ -90,11 +244,16 @@ void rand(Qureg qureg, int qubit) {
       v.x = 1; v.y = 1; v.z = 0;
     }
 
-    rotateAroundAxis(qureg, qubit, M_PI / 2, v);
+    return v;
+}
+
+void rand(Qureg qureg, int qubit) {
+  rotateAroundAxis(qureg, qubit, M_PI / 2, random_axis());
 }
 
-void random_circuit(Qureg qureg, int depth) {
-  for (int i = 0; i < depth; i++) {
+// Runs layers first to last - 1
+void random_circuit(Qureg qureg, int first, int last) {
+  for (int i = first; i < last; i++) {
     for (int j = 0; j < qureg.numQubitsRepresented; j++)
       rand(qureg, j);
     for (int j = i % 2; j < qureg.numQubitsRepresented - 1; j += 2)
@@ -102,9 +261,100 @@ void random_circuit(Qureg qureg, int depth) {
   }
 }
 
+// Same circuit as random_circuit, collected into a gate list for fusion
+vector<Gate> random_circuit_gates(int nqubits, int first, int last) {
+  vector<Gate> gates;
+  for (int i = first; i < last; i++) {
+    for (int j = 0; j < nqubits; j++)
+      gates.push_back(rotation_gate(j, M_PI / 2, random_axis()));
+    for (int j = i % 2; j < nqubits - 1; j += 2)
+      gates.push_back(phase_gate(j, j + 1, 2 * M_PI / 4));
+  }
+
+  return gates;
+}
+
+// Splits layers first to depth into checkpoint segments of every layers (all
+// of them in one if every is 0) and, outside gates mode, draws and fuses each
+// segment's gates, scheduling them in scheduled mode from the layout map.
+// Counts the gates and blocks, and the exchanges of the schedules and of the
+// unscheduled gates into stats.
+vector<Segment> build_segments(int nqubits, int first, int depth, int every, string const& mode,
+                               int fuse_qubits, int cache_qubits, int local, long long chunk,
+                               QubitMap map, long& ngates, long& nblocks, ScheduleStats& stats) {
+  vector<Segment> segments;
+  ngates = nblocks = 0;
+  stats = {0, 0, 0, 0};
+  int length = every > 0 ? every : depth;
+  for (int start = first; start < depth; start += length) {
+    Segment segment = {start, min(depth, start + length), {}, {}, map};
+    if (mode == "gates") {
+      segments.push_back(segment);
+      continue;
+    }
+
+    vector<Gate> gates = random_circuit_gates(nqubits, segment.start, segment.stop);
+    segment.blocks = fuse_gates(gates, fuse_qubits, cache_qubits);
+    ngates += gates.size();
+    nblocks += segment.blocks.size();
+    if (mode == "scheduled") {
+      ScheduleStats segment_stats = {0, 0, 0, 0};
+      naive_schedule(gates, local, segment_stats, chunk);
+      segment.steps = schedule_gates(segment.blocks, map, local, segment_stats, chunk);
+      segment.map = map;
+      stats.exchanges += segment_stats.exchanges;
+      stats.bytes += segment_stats.bytes;
+      stats.naive_exchanges += segment_stats.naive_exchanges;
+      stats.naive_bytes += segment_stats.naive_bytes;
+    }
+    segments.push_back(segment);
+  }
+
+  return segments;
+}
+
+// Prints the memory per node, runtime and energy of this run on every node
+// count and frequency it fits, from passes calibrated on this machine.
+// Checkpoint writes are not included.
+void plan_rand(QuESTEnv env, int qreg_size, int depth, string const& mode, int fuse_qubits,
+               int cache_qubits, Harness const& harness) {
+  int n = qreg_size;
+  vector<Gate> gates = random_circuit_gates(n, 0, depth);
+  vector<Gate> blocks = mode == "gates" ? gates : fuse_gates(gates, fuse_qubits, cache_qubits);
+
+  int calibration_qubits = min(n, CALIBRATION_QUBITS);
+  PlanFreq cal = plan_current_freq();
+  PassRates rates = calibrate_passes(env, calibration_qubits, CALIBRATION_REPS);
+
+  auto node_bytes = [&](int nodes) { return state_bytes(n, nodes); };
+  auto node_ms = [&](int nodes, PlanFreq const& freq) {
+    int local = n - (int) log2(nodes);
+    double chunk = ldexp(2.0 * sizeof(qreal), local);
+    PassPlan circuit;
+    if (mode == "fused")
+      circuit = plan_fused(blocks, local, cache_qubits);
+    else if (mode == "scheduled")
+      circuit = plan_scheduled(blocks, n, local, cache_qubits);
+    else
+      circuit = plan_gates(blocks, local);
+    return (harness.warmup + harness.reps) * plan_pass_ms(circuit, rates, chunk, cal, freq);
+  };
+  int max_nodes = min(PLAN_MAX_NODES, 1 << min(n - fuse_qubits, 30));
+  auto configs = plan_configs(max_nodes, node_bytes, node_ms);
+
+  if (env.rank == 0) {
+    cout << "Plan for " << n << " qubits, depth " << depth << ", mode " << mode << ", "
+         << PRECISION_NAME << " precision" << endl;
+    cout << "Calibration at " << cal.name << " on " << calibration_qubits << " qubits: dense pass "
+         << 2 / (rates.dense * 1E6) << " GB/s, diagonal pass " << 2 / (rates.diagonal * 1E6)
+         << " GB/s" << endl;
+    plan_print(cout, configs, max_nodes);
+  }
+}
+
 void print_qureg(Qureg qureg) {
-  int numStates = 1 << qureg.numQubitsRepresented;
-  for (int i = 0; i < numStates; i++) {
+  long long numStates = 1LL << qureg.numQubitsRepresented;
+  for (long long i = 0; i < numStates; i++) {
     Complex amp = getAmp(qureg, i);
     bitset<QREG_MAX> ibits(i);
 
@@ -113,19 +363,44 @@ void print_qureg(Qureg qureg) {
   }
 }
 
-void set_args(int argc, char* argv[], int& qreg_size, int& depth) {
+void set_args(int argc, char* argv[], int& qreg_size, int& depth, string& mode,
+              int& fuse_qubits, int& cache_qubits, int& ckpt_every, string& ckpt_file,
+              int& resume, int& plan, Harness& harness) {
   for (int i = 1; i < argc; i++) {
     string arg = argv[i];
     if (arg == "-q") {
       qreg_size = atoi(argv[++i]);
     } else if (arg == "-d") {
       depth = atoi(argv[++i]);
+    } else if (arg == "-m") {
+      mode = argv[++i];
+    } else if (arg == "-k") {
+      fuse_qubits = atoi(argv[++i]);
+    } else if (arg == "-b") {
+      cache_qubits = atoi(argv[++i]);
+    } else if (arg == "-c") {
+      ckpt_every = atoi(argv[++i]);
+    } else if (arg == "-f") {
+      ckpt_file = argv[++i];
+    } else if (arg == "-r") {
+      resume = 1;
+    } else if (arg == "-p") {
+      plan = 1;
+    } else if (arg == "-w") {
+      harness.warmup = atoi(argv[++i]);
+    } else if (arg == "-n") {
+      harness.reps = atoi(argv[++i]);
+    } else if (arg == "-j") {
+      harness.json_path = argv[++i];
     } else {
       string message = "Error: Unknown argument '" + arg + 
-        "'! Use: ./bin -q $NQUBITS -d $DEPTH";
+        "'! Use: ./bin -q $NQUBITS -d $DEPTH -m $MODE [-c $EVERY -f $FILE -r] [-p] [-w $WARMUP -n $REPS -j $JSON]";
       throw invalid_argument(message);
     }
   }
+
+  if (harness.warmup < 0 || harness.reps < 1)
+    throw invalid_argument("Error: -w must be at least 0 and -n at least 1");
 }
 
 int set_verbose() {